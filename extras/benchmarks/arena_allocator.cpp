@@ -0,0 +1,63 @@
+// Heap allocations and build time of a 20 key message, with the heap allocator and with the message arena.
+//
+// g++ -O2 -std=gnu++11 -I../../src arena_allocator.cpp -o arena_allocator && ./arena_allocator
+
+#include <stdio.h>
+#include <chrono>
+#include "thinger/pson.h"
+
+using namespace protoson;
+
+// counts the allocations served by the heap
+class counting_heap_allocator : public dynamic_memory_allocator{
+public:
+    size_t allocations = 0;
+
+    virtual void *allocate(size_t size){
+        allocations++;
+        return dynamic_memory_allocator::allocate(size);
+    }
+};
+
+// forwards to the allocator being measured
+class bench_allocator : public memory_allocator{
+public:
+    memory_allocator* target = NULL;
+
+    virtual void *allocate(size_t size){ return target->allocate(size); }
+    virtual void *allocate(size_t size, node_type type){ return target->allocate(size, type); }
+    virtual void deallocate(void *ptr){ target->deallocate(ptr); }
+    virtual void begin_scope(){ target->begin_scope(); }
+    virtual void end_scope(){ target->end_scope(); }
+};
+
+bench_allocator bench;
+memory_allocator& protoson::pool = bench;
+
+static const int messages = 200000;
+static char keys[20][8];
+
+static double build_messages(){
+    auto start = std::chrono::steady_clock::now();
+    for(int i=0; i<messages; i++){
+        memory_scope scope;
+        pson message;
+        for(int k=0; k<20; k++) message[(const char*)keys[k]] = k*1000 + 0.5f;
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-start).count() / messages;
+}
+
+int main(){
+    for(int k=0; k<20; k++) sprintf(keys[k], "key%d", k);
+
+    counting_heap_allocator heap;
+    bench.target = &heap;
+    double heap_ns = build_messages();
+    printf("heap:  %.1f allocations/message, %.0f ns/message\n", (double)heap.allocations / messages, heap_ns);
+
+    static arena_memory_allocator<2048> arena;
+    bench.target = &arena;
+    double arena_ns = build_messages();
+    printf("arena: %s, %zu bytes high water, %.0f ns/message\n",
+        arena.high_water() < 2048 ? "no heap allocations" : "arena exhausted", arena.high_water(), arena_ns);
+}
@@ -0,0 +1,75 @@
+// Encoding time of nested objects with the streaming encoder, which sizes every submessage before writing it, and
+// with the single pass buffer encoder, which back-patches the sizes.
+//
+// g++ -O2 -std=gnu++11 -I../../src buffer_encoder.cpp -o buffer_encoder && ./buffer_encoder
+
+// the size cache would hide the sizing passes while encoding the same tree again and again
+#define PSON_DISABLE_SIZE_CACHE
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "thinger/pson.h"
+
+using namespace protoson;
+
+dynamic_memory_allocator alloc;
+memory_allocator& protoson::pool = alloc;
+
+// streaming encoder over a vector, as the encoders writing to a connection
+class vector_encoder : public pson_encoder{
+public:
+    std::vector<uint8_t> output;
+
+protected:
+    virtual bool write(const void* buffer, size_t size){
+        output.insert(output.end(), (const uint8_t*)buffer, (const uint8_t*)buffer + size);
+        return pson_encoder::write(buffer, size);
+    }
+};
+
+static const int iterations = 20000;
+
+static void fill(pson& value, int depth, uint8_t* blob){
+    value["id"] = depth;
+    value["name"] = "sensor";
+    value["ratio"] = 0.25f;
+    pson_array& samples = value["samples"];
+    for(int i=0; i<8; i++) samples.add(i*100);
+    if(depth==0){
+        value["blob"].set_bytes(blob, 300);
+    }else{
+        fill(value["child"], depth-1, blob);
+    }
+}
+
+int main(){
+    uint8_t blob[300];
+    memset(blob, 0x5A, sizeof(blob));
+    for(int depth=0; depth<=5; depth++){
+        pson value;
+        fill(value, depth, blob);
+
+        vector_encoder streaming;
+        auto start = std::chrono::steady_clock::now();
+        for(int i=0; i<iterations; i++){
+            streaming.output.clear();
+            streaming.encode(value);
+        }
+        double streaming_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-start).count() / iterations;
+
+        pson_buffer_encoder buffer;
+        start = std::chrono::steady_clock::now();
+        for(int i=0; i<iterations; i++){
+            buffer.reset();
+            buffer.encode(value);
+        }
+        double buffer_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-start).count() / iterations;
+
+        bool same = buffer.get_buffer().size()==streaming.output.size() &&
+            memcmp(buffer.get_buffer().data(), streaming.output.data(), streaming.output.size())==0;
+        printf("depth %d, %zu bytes: streaming %.0f ns, buffer %.0f ns, %s output\n", depth, streaming.output.size(),
+            streaming_ns, buffer_ns, same ? "same" : "DIFFERENT");
+    }
+}
@@ -0,0 +1,97 @@
+// Virtual write() calls made by the encoder, and read() calls made by the memory decoder, for a stream sample
+// with four scalars and a 16 item array.
+//
+// g++ -O2 -std=gnu++11 -I../../src encoder_calls.cpp -o encoder_calls && ./encoder_calls
+
+#include <stdio.h>
+#include <chrono>
+#include <vector>
+#include "thinger/thinger.h"
+
+using namespace protoson;
+using namespace thinger;
+
+dynamic_memory_allocator alloc;
+memory_allocator& protoson::pool = alloc;
+
+// connection counting the writes of the encoder
+class counting_io : public thinger_io{
+public:
+    size_t writes = 0;
+    size_t bytes = 0;
+
+    virtual bool read(char* buffer, size_t size){
+        return false;
+    }
+
+    virtual bool write(const char* buffer, size_t size, bool flush){
+        writes++;
+        bytes += size;
+        return true;
+    }
+};
+
+// message encoder over a vector
+class vector_encoder : public thinger_encoder{
+public:
+    std::vector<uint8_t> output;
+
+protected:
+    virtual bool write(const void* buffer, size_t size){
+        output.insert(output.end(), (const uint8_t*)buffer, (const uint8_t*)buffer + size);
+        return pson_encoder::write(buffer, size);
+    }
+};
+
+// memory decoder counting the reads that go through the virtual read()
+class counting_decoder : public thinger_memory_decoder{
+public:
+    static size_t reads;
+
+    counting_decoder(uint8_t* buffer, size_t size) : thinger_memory_decoder(buffer, size){
+    }
+
+protected:
+    virtual bool read(void* buffer, size_t size){
+        reads++;
+        return thinger_memory_decoder::read(buffer, size);
+    }
+};
+
+size_t counting_decoder::reads = 0;
+
+static const int iterations = 200000;
+
+int main(){
+    thinger_message message;
+    message.set_stream_id(12);
+    message.set_signal_flag(thinger_message::STREAM_SAMPLE);
+    pson& out = message.get_data()["out"];
+    out["temperature"] = 21.5f;
+    out["humidity"] = 40;
+    out["name"] = "living room";
+    out["pressure"] = 1013.25;
+    pson_array& samples = out["samples"];
+    for(int i=0; i<16; i++) samples.add(i*137);
+
+    counting_io io;
+    thinger_write_encoder encoder(io);
+    auto start = std::chrono::steady_clock::now();
+    for(int i=0; i<iterations; i++) encoder.encode(message);
+    double encode_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-start).count() / iterations;
+    printf("encode: %zu bytes, %.0f write calls, %.2f bytes/call, %.0f ns/message\n", io.bytes / iterations,
+        (double)io.writes / iterations, (double)io.bytes / io.writes, encode_ns);
+
+    vector_encoder frame;
+    frame.encode(message);
+    start = std::chrono::steady_clock::now();
+    for(int i=0; i<iterations; i++){
+        counting_decoder decoder(frame.output.data(), frame.output.size());
+        thinger_message decoded;
+        decoder.decode(decoded, frame.output.size());
+        // payloads kept as a view are decoded on access
+        decoded.get_data()["out"];
+    }
+    double decode_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now()-start).count() / iterations;
+    printf("decode: %.0f read calls, %.0f ns/message\n", (double)counting_decoder::reads / iterations, decode_ns);
+}
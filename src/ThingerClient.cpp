@@ -4,13 +4,29 @@
 using namespace protoson;
 
 #ifndef THINGER_DO_NOT_INIT_MEMORY_ALLOCATOR
-    #ifndef THINGER_USE_STATIC__MEMORY
-        dynamic_memory_allocator alloc;
-    #else
+    #if defined(THINGER_USE_STATIC__MEMORY)
         #ifndef THINGER_STATIC_MEMORY_SIZE
             #define THINGER_STATIC_MEMORY_SIZE 512
         #endif
         circular_memory_allocator<THINGER_STATIC_MEMORY_SIZE> alloc;
+    #elif defined(THINGER_USE_ARENA_MEMORY)
+        #ifndef THINGER_ARENA_MEMORY_SIZE
+            #define THINGER_ARENA_MEMORY_SIZE 1024
+        #endif
+        arena_memory_allocator<THINGER_ARENA_MEMORY_SIZE> alloc;
+    #elif defined(THINGER_USE_SLAB_MEMORY)
+        #ifndef THINGER_SLAB_PAIRS
+            #define THINGER_SLAB_PAIRS 32
+        #endif
+        #ifndef THINGER_SLAB_ITEMS
+            #define THINGER_SLAB_ITEMS 16
+        #endif
+        #ifndef THINGER_SLAB_CONTAINERS
+            #define THINGER_SLAB_CONTAINERS 16
+        #endif
+        slab_memory_allocator<THINGER_SLAB_PAIRS, THINGER_SLAB_ITEMS, THINGER_SLAB_CONTAINERS> alloc;
+    #else
+        dynamic_memory_allocator alloc;
     #endif
     memory_allocator& protoson::pool = alloc;
 #endif
\ No newline at end of file
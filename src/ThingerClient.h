@@ -129,11 +129,39 @@ emyPxgcYxn/eR44/KJ4EBs+lVDR3veyJm+kXQ99b21/+jh5Xos1AnX5iItreGCc=
     #define DEFAULT_READ_TIMEOUT 10000   // milliseconds
 #endif
 
+// bytes read from the socket in a single call and kept for the decoder. Set to 0 to read directly from the client
+#ifndef THINGER_INPUT_BUFFER_SIZE
+    #if defined(__AVR__)
+        #define THINGER_INPUT_BUFFER_SIZE 32
+    #else
+        #define THINGER_INPUT_BUFFER_SIZE 256
+    #endif
+#endif
+
 // set to 0 to increase buffer as required (less performing but memory saving!)
 #ifndef THINGER_OUTPUT_BUFFER_GROWING_SIZE
     #define THINGER_OUTPUT_BUFFER_GROWING_SIZE 32
 #endif
 
+// output buffers up to this size (bytes) are kept allocated after flushing, so they can be reused by next messages
+#ifndef THINGER_OUTPUT_BUFFER_KEEP_SIZE
+    #if defined(__AVR__)
+        #define THINGER_OUTPUT_BUFFER_KEEP_SIZE 0
+    #else
+        #define THINGER_OUTPUT_BUFFER_KEEP_SIZE 512
+    #endif
+#endif
+
+// release the kept output buffer after being unused for this time (milliseconds). Set to 0 to never release it
+#ifndef THINGER_OUTPUT_BUFFER_IDLE_RELEASE
+    #define THINGER_OUTPUT_BUFFER_IDLE_RELEASE 30000
+#endif
+
+// define to a size greater than 0 to use a static output buffer of that size instead of allocating it in the heap
+#ifndef THINGER_OUTPUT_BUFFER_STATIC_SIZE
+    #define THINGER_OUTPUT_BUFFER_STATIC_SIZE 0
+#endif
+
 
 #if defined(_DEBUG_) || defined(THINGER_SERIAL_DEBUG)
     #define _DEBUG_
@@ -172,29 +200,41 @@ public:
             host_(THINGER_SERVER),
             root_ca_(CA_ROOT_CERTIFICATE)
 #ifndef THINGER_DISABLE_OUTPUT_BUFFER
-            ,out_buffer_(NULL), out_size_(0), out_total_size_(0)
+    #if THINGER_OUTPUT_BUFFER_STATIC_SIZE > 0
+            ,out_size_(0), out_total_size_(THINGER_OUTPUT_BUFFER_STATIC_SIZE), out_last_use_(0)
+    #else
+            ,out_buffer_(NULL), out_size_(0), out_total_size_(0), out_last_use_(0)
+    #endif
+#endif
+#if THINGER_INPUT_BUFFER_SIZE > 0
+            ,in_start_(0), in_end_(0)
 #endif
     {
     }
 
     ~ThingerClient()
     {
-
+#if !defined(THINGER_DISABLE_OUTPUT_BUFFER) && THINGER_OUTPUT_BUFFER_STATIC_SIZE == 0
+        free(out_buffer_);
+#endif
     }
 
 protected:
 
+    virtual unsigned long get_millis(){
+        return millis();
+    }
+
     virtual bool read(char* buffer, size_t size)
     {
         unsigned long start = millis();
         size_t total_read = 0;
         //THINGER_DEBUG_VALUE("THINGER", "Reading bytes: ", size);
         while(total_read<size){
-            // For solving this issue: https://github.com/ntruchsess/arduino_uip/issues/149
-            #ifdef UIPETHERNET_H
-            int read = client_.read((uint8_t*)(buffer+total_read), size-total_read);
+            #if THINGER_INPUT_BUFFER_SIZE > 0
+            int read = buffered_read(buffer+total_read, size-total_read);
             #else
-            int read = client_.readBytes((char*)buffer+total_read, size-total_read);
+            int read = client_read(buffer+total_read, size-total_read);
             #endif
             //THINGER_DEBUG_VALUE("THINGER", "Read bytes: ", read);
             total_read += read;
@@ -221,57 +261,84 @@ protected:
         return total_read == size;
     }
 
+    virtual size_t read_available(char* buffer, size_t size){
+        size_t available = input_available();
+        if(available==0) return 0;
+        if(size>available) size = available;
+        return read(buffer, size) ? size : 0;
+    }
+
+    int client_read(char* buffer, size_t size){
+        // For solving this issue: https://github.com/ntruchsess/arduino_uip/issues/149
+        #ifdef UIPETHERNET_H
+        return client_.read((uint8_t*)buffer, size);
+        #else
+        return client_.readBytes(buffer, size);
+        #endif
+    }
+
+#if THINGER_INPUT_BUFFER_SIZE > 0
+    /**
+     * Serve reads from the input buffer, which is refilled with all the bytes available in the client (up to
+     * THINGER_INPUT_BUFFER_SIZE) in a single call, instead of reading from the client byte by byte.
+     */
+    int buffered_read(char* buffer, size_t size){
+        if(in_start_==in_end_){
+            in_start_ = in_end_ = 0;
+            int available = client_.available();
+            // nothing to buffer (wait for data as usual), or a read larger than the buffer
+            if(available<=0 || size>=THINGER_INPUT_BUFFER_SIZE){
+                return client_read(buffer, size);
+            }
+            int read = client_.read(in_buffer_, (size_t)available < THINGER_INPUT_BUFFER_SIZE ? available : THINGER_INPUT_BUFFER_SIZE);
+            if(read<=0) return read;
+            in_end_ = read;
+        }
+        size_t pending = in_end_ - in_start_;
+        size_t read = size < pending ? size : pending;
+        memcpy(buffer, &in_buffer_[in_start_], read);
+        in_start_ += read;
+        return read;
+    }
+#endif
+
+    virtual size_t input_available(){
+        #if THINGER_INPUT_BUFFER_SIZE > 0
+        size_t buffered = in_end_ - in_start_;
+        if(buffered>0) return buffered;
+        #endif
+        int available = client_.available();
+        return available > 0 ? available : 0;
+    }
+
+    void clear_input(){
+        #if THINGER_INPUT_BUFFER_SIZE > 0
+        in_start_ = in_end_ = 0;
+        #endif
+    }
+
     virtual bool write(const char* buffer, size_t size, bool flush=false){
         #ifndef THINGER_DISABLE_OUTPUT_BUFFER
+        // complete frames with nothing pending in the output buffer can be written directly
+        if(flush && out_size_==0){
+            return size==0 || client_write(buffer, size);
+        }
         if(size>0){
             #ifdef _DEBUG_MEMORY_
             THINGER_DEBUG_VALUE("_MEMORY", "Writing to Output Buffer: ", size)
             #endif
 
-            #if THINGER_OUTPUT_BUFFER_GROWING_SIZE > 0
             // check if it is necessary to increase output size
-            if(out_size_+size>out_total_size_){
-                // compute new buffer size
-                out_total_size_ += (size/THINGER_OUTPUT_BUFFER_GROWING_SIZE + (size % THINGER_OUTPUT_BUFFER_GROWING_SIZE != 0)) * THINGER_OUTPUT_BUFFER_GROWING_SIZE;
-                // reallocate buffer
-                void * new_buffer = realloc(out_buffer_, out_total_size_);
-                // increase current total size
-                if(new_buffer!=NULL){
-                    out_buffer_ = (uint8_t*) new_buffer;
-                    #ifdef _DEBUG_MEMORY_
-                    THINGER_DEBUG_VALUE("_MEMORY", "Increased buffer size to: ", out_total_size_)
-                    THINGER_DEBUG_VALUE("_MEMORY", "Realloc Address: ", (unsigned long) out_buffer_)
-                    #endif
-                }else{
-                    // Realloc problem! Not enough memory, flushing out buffer and writing directly from the incoming buffer
-                    #ifdef _DEBUG_MEMORY_
-                    THINGER_DEBUG("_MEMORY", "Output Memory Buffer Exhausted!");
-                    #endif
-                    return flush_out_buffer() && client_write(buffer, size);
-                }
-            }
-            // copy current input to buffer
-            memcpy(&out_buffer_[out_size_], buffer, size);
-            out_size_ += size;
-
-            #else
-            void * new_buffer = realloc(out_buffer_, out_size_ + size);
-            if(new_buffer!=NULL){
-                #ifdef _DEBUG_MEMORY_
-                THINGER_DEBUG_VALUE("_MEMORY", "Increased buffer size to: ", out_size_ + size)
-                THINGER_DEBUG_VALUE("_MEMORY", "Realloc Address: ", (unsigned long) new_buffer)
-                #endif
-                out_buffer_ = (uint8_t*) new_buffer;
-                memcpy(&out_buffer_[out_size_], buffer, size);
-                out_size_ += size;
-            }else{
-                // Realloc problem! Not enough memory, flushing out buffer and writing directly from the incoming buffer
+            if(!reserve_out_buffer(out_size_+size)){
+                // Not enough memory, flushing out buffer and writing directly from the incoming buffer
                 #ifdef _DEBUG_MEMORY_
                 THINGER_DEBUG("_MEMORY", "Output Memory Buffer Exhausted!");
                 #endif
                 return flush_out_buffer() && client_write(buffer, size);
             }
-            #endif
+            // copy current input to buffer
+            memcpy(&out_buffer_[out_size_], buffer, size);
+            out_size_ += size;
         }
         if(flush){
             return flush_out_buffer();
@@ -312,22 +379,71 @@ protected:
 
 #ifndef THINGER_DISABLE_OUTPUT_BUFFER
     bool flush_out_buffer(){
-        if(out_buffer_!=NULL && out_size_>0){
+        if(out_size_>0){
             bool success = client_write((const char*)out_buffer_, out_size_);
-
-#ifdef _DEBUG_MEMORY_
-            THINGER_DEBUG_VALUE("_MEMORY", "Releasing memory size: ", out_total_size_)
-            THINGER_DEBUG_VALUE("_MEMORY", "Release Address: ", (unsigned long) out_buffer_)
-#endif
-
-            free(out_buffer_);
-            out_buffer_ = NULL;
             out_size_ = 0;
-            out_total_size_ = 0;
+            out_last_use_ = millis();
+            // keep small buffers for the next messages, release the ones grown by large messages
+            if(out_total_size_>THINGER_OUTPUT_BUFFER_KEEP_SIZE) release_out_buffer();
             return success;
         }
         return true;
     }
+
+    /**
+     * Ensure the output buffer can hold the required bytes. The buffer grows geometrically, so a message written
+     * in small pieces, or successive messages, do not require a reallocation on every write.
+     */
+    bool reserve_out_buffer(size_t required){
+        if(required<=out_total_size_) return true;
+#if THINGER_OUTPUT_BUFFER_STATIC_SIZE > 0
+        return false;
+#else
+        size_t new_size = required;
+    #if THINGER_OUTPUT_BUFFER_GROWING_SIZE > 0
+        if(new_size<out_total_size_*2) new_size = out_total_size_*2;
+        new_size = (new_size + THINGER_OUTPUT_BUFFER_GROWING_SIZE - 1) / THINGER_OUTPUT_BUFFER_GROWING_SIZE * THINGER_OUTPUT_BUFFER_GROWING_SIZE;
+    #endif
+        void * new_buffer = realloc(out_buffer_, new_size);
+        // try again with the exact size if there is no memory for growing the buffer
+        if(new_buffer==NULL && new_size>required){
+            new_size = required;
+            new_buffer = realloc(out_buffer_, new_size);
+        }
+        if(new_buffer==NULL) return false;
+        out_buffer_ = (uint8_t*) new_buffer;
+        out_total_size_ = new_size;
+    #ifdef _DEBUG_MEMORY_
+        THINGER_DEBUG_VALUE("_MEMORY", "Increased buffer size to: ", out_total_size_)
+        THINGER_DEBUG_VALUE("_MEMORY", "Realloc Address: ", (unsigned long) out_buffer_)
+    #endif
+        return true;
+#endif
+    }
+
+    void release_out_buffer(){
+#if THINGER_OUTPUT_BUFFER_STATIC_SIZE == 0
+        if(out_buffer_==NULL || out_size_>0) return;
+    #ifdef _DEBUG_MEMORY_
+        THINGER_DEBUG_VALUE("_MEMORY", "Releasing memory size: ", out_total_size_)
+        THINGER_DEBUG_VALUE("_MEMORY", "Release Address: ", (unsigned long) out_buffer_)
+    #endif
+        free(out_buffer_);
+        out_buffer_ = NULL;
+        out_total_size_ = 0;
+#endif
+    }
+
+    /**
+     * Release the kept output buffer if it has not been used for THINGER_OUTPUT_BUFFER_IDLE_RELEASE milliseconds
+     */
+    void release_idle_out_buffer(){
+#if THINGER_OUTPUT_BUFFER_IDLE_RELEASE > 0
+        if(out_total_size_>0 && out_size_==0 && millis()-out_last_use_>=THINGER_OUTPUT_BUFFER_IDLE_RELEASE){
+            th_synchronized(release_out_buffer();)
+        }
+#endif
+    }
 #endif
 
     virtual void disconnected(){
@@ -465,6 +581,7 @@ protected:
     bool connect_client(){
         bool connected = false;
         client_.stop(); // cleanup previous socket
+        clear_input();
         thinger_state_listener(SOCKET_CONNECTING);
         if (connect_socket()) {
             thinger_state_listener(SOCKET_CONNECTED);
@@ -503,18 +620,22 @@ public:
         thinger::thinger::disconnected();
     }
 
-    void handle(){
+    size_t handle(){
+        #ifndef THINGER_DISABLE_OUTPUT_BUFFER
+        release_idle_out_buffer();
+        #endif
         if(handle_connection()){
-            th_synchronized(size_t available = client_.available();)
+            th_synchronized(size_t available = input_available();)
             #ifdef _DEBUG_
             if(available>0){
                 THINGER_DEBUG_VALUE("THINGER", "Available bytes: ", available);
             }
             #endif
-            thinger::thinger::handle(millis(), available>0);
+            return thinger::thinger::handle(millis(), available>0);
         }else{
             delay(RECONNECTION_TIMEOUT); // get some delay for a connection retry
         }
+        return 0;
     }
 
     bool is_connected(){
@@ -581,9 +702,20 @@ private:
 #endif
 
 #ifndef THINGER_DISABLE_OUTPUT_BUFFER
+#if THINGER_OUTPUT_BUFFER_STATIC_SIZE > 0
+    uint8_t out_buffer_[THINGER_OUTPUT_BUFFER_STATIC_SIZE];
+#else
     uint8_t * out_buffer_;
+#endif
     size_t out_size_;
     size_t out_total_size_;
+    unsigned long out_last_use_;
+#endif
+
+#if THINGER_INPUT_BUFFER_SIZE > 0
+    uint8_t in_buffer_[THINGER_INPUT_BUFFER_SIZE];
+    size_t in_start_;
+    size_t in_end_;
 #endif
 
 };
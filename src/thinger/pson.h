@@ -37,6 +37,45 @@
 #define UINT32_MAX  4294967295U
 #endif
 
+// values up to this size (varints, floats, short strings) are stored inside the pson instead of the memory pool.
+// Set to 0 for allocating all values in the pool
+#ifndef PSON_INLINE_SIZE
+#define PSON_INLINE_SIZE sizeof(void*)
+#endif
+
+// objects whose key lookups traverse at least this number of keys build a hash index for the next lookups.
+// Set to 0 for always using a linear search
+#ifndef PSON_OBJECT_INDEX_THRESHOLD
+#define PSON_OBJECT_INDEX_THRESHOLD 16
+#endif
+
+// type of the item count of objects and arrays, which cannot hold more items than it can count. Narrower on AVR,
+// where a container larger than 255 items does not fit in memory anyway
+#ifndef PSON_CONTAINER_SIZE_TYPE
+    #if defined(__AVR__)
+        #define PSON_CONTAINER_SIZE_TYPE uint8_t
+    #else
+        #define PSON_CONTAINER_SIZE_TYPE size_t
+    #endif
+#endif
+
+// packed numeric arrays are sent as regular arrays unless the server is known to support the packed fields
+//#define PSON_ENCODE_PACKED_ARRAYS
+
+// maximum nesting of objects and arrays written with a pson_writer
+#ifndef PSON_WRITER_MAX_DEPTH
+#define PSON_WRITER_MAX_DEPTH 8
+#endif
+
+// strings, bytes, and packed arrays decoded with a pson_listener are delivered in chunks up to this size
+#ifndef PSON_LISTENER_CHUNK_SIZE
+    #if defined(__AVR__)
+        #define PSON_LISTENER_CHUNK_SIZE 32
+    #else
+        #define PSON_LISTENER_CHUNK_SIZE 128
+    #endif
+#endif
+
 /*
  * Dummy placement new operator to support old Arduino compilers where this operator is not defined
  * (and cannot be used from inside a class), and also to not overwrite global operator from modern
@@ -49,17 +88,34 @@ namespace protoson {
     class memory_allocator{
     public:
 
+        // kind of pson node being allocated, so allocators can keep each node type in its own pool
+        enum node_type{
+            any_node,
+            pair_node,
+            item_node,
+            container_node
+        };
+
         // allocate
         virtual void *allocate(size_t size) = 0;
         virtual void deallocate(void *) = 0;
 
+        // allocate a pson node of the given type. By default it is served as any other allocation
+        virtual void *allocate(size_t size, node_type type){
+            return allocate(size);
+        }
+
+        // notify the allocator that the nodes of a single message are going to be allocated
+        virtual void begin_scope() {}
+        virtual void end_scope() {}
+
         template <class T>
-        T* allocate(){
+        T* allocate(node_type type=any_node){
             /*
              * placement new has UB if memory is NULL, so check there is memory
              * before trying to call the operator
              */
-            if(void * memory = allocate(sizeof(T))){
+            if(void * memory = allocate(sizeof(T), type)){
                 return new (memory, NULL) T();
             }
             return NULL;
@@ -109,7 +165,91 @@ namespace protoson {
         }
     };
 
+    /*
+     * Allocator that serves every allocation done inside a message scope from a fixed arena, by just
+     * increasing an index. Deallocations inside the arena are not released individually: the whole arena is
+     * reset once its last live allocation is released, i.e., when the message is done. Allocations outside a
+     * scope, or not fitting in the arena, fall back to the heap.
+     */
+    template<size_t arena_size>
+    class arena_memory_allocator : public memory_allocator{
+    private:
+        union{
+            uint8_t buffer_[arena_size];
+            void* pointer_alignment_;
+            double double_alignment_;
+        };
+        size_t index_;
+        size_t high_water_;
+        size_t live_;
+        uint8_t scopes_;
+        dynamic_memory_allocator heap_;
+
+        static size_t align(size_t size){
+            const size_t alignment = sizeof(double) > sizeof(void*) ? sizeof(double) : sizeof(void*);
+            return (size + alignment - 1) & ~(alignment - 1);
+        }
+
+    public:
+        arena_memory_allocator() : index_(0), high_water_(0), live_(0), scopes_(0) {
+        }
+
+        virtual void *allocate(size_t size) {
+            if(scopes_>0){
+                size_t aligned_size = align(size);
+                if(index_ + aligned_size <= arena_size){
+                    void *position = &buffer_[index_];
+                    index_ += aligned_size;
+                    if(index_>high_water_) high_water_ = index_;
+                    live_++;
+                    return position;
+                }
+            }
+            return heap_.allocate(size);
+        }
+
+        virtual void deallocate(void *ptr) {
+            if((uint8_t*)ptr>=buffer_ && (uint8_t*)ptr<buffer_+arena_size){
+                // bulk release of the arena once all its allocations are done
+                if(--live_==0) index_ = 0;
+            }else{
+                heap_.deallocate(ptr);
+            }
+        }
+
+        virtual void begin_scope() {
+            scopes_++;
+        }
+
+        virtual void end_scope() {
+            if(scopes_>0) scopes_--;
+        }
+
+        size_t used() const{
+            return index_;
+        }
+
+        size_t high_water() const{
+            return high_water_;
+        }
+    };
+
     extern memory_allocator& pool;
+
+    /*
+     * Marks the lifetime of a message in the memory pool, so allocators like the arena can release all
+     * the message nodes at once.
+     */
+    class memory_scope{
+    public:
+        memory_scope(){
+            pool.begin_scope();
+        }
+
+        ~memory_scope(){
+            pool.end_scope();
+        }
+    };
 }
 
 namespace protoson {
@@ -122,17 +262,32 @@ namespace protoson {
         pson_type = 6
     };
 
+    class pson;
+    class pson_pair;
+
+    // node type of the list items holding T in a pson container
+    template<class T>
+    struct pson_item_node{
+        static const memory_allocator::node_type type = memory_allocator::item_node;
+    };
+
+    template<>
+    struct pson_item_node<pson_pair>{
+        static const memory_allocator::node_type type = memory_allocator::pair_node;
+    };
+
     template<class T>
     class pson_container {
 
+    public:
+
         class list_item{
         public:
-            list_item() : next_(NULL), previous_(NULL) {}
+            list_item() : next_(NULL) {}
             ~list_item(){}
 
             T item_;
             list_item* next_;
-            list_item* previous_;
         };
 
     public:
@@ -166,9 +321,13 @@ namespace protoson {
             }
         };
 
-    private:
+    protected:
         list_item* item_;
         list_item* last_;
+        PSON_CONTAINER_SIZE_TYPE count_;
+#ifndef PSON_DISABLE_SIZE_CACHE
+        size_t encoded_size_;
+#endif
 
     public:
         iterator begin() const{
@@ -179,56 +338,110 @@ namespace protoson {
             return iterator(last_);
         }
 
-        pson_container() : item_(NULL), last_(NULL) {
+#ifndef PSON_DISABLE_SIZE_CACHE
+        pson_container() : item_(NULL), last_(NULL), count_(0), encoded_size_((size_t)-1) {
+        }
+#else
+        pson_container() : item_(NULL), last_(NULL), count_(0) {
         }
+#endif
 
         ~pson_container(){
             clear();
         }
 
-        size_t size() const{
-            size_t size = 0;
-            list_item* current = item_;
-            while(current!=NULL){
-                current = current->next_;
-                size++;
+        // containers own their items, so they can be moved but not copied
+        pson_container(pson_container&& other) : item_(NULL), last_(NULL), count_(0)
+#ifndef PSON_DISABLE_SIZE_CACHE
+            , encoded_size_((size_t)-1)
+#endif
+        {
+            take(other);
+        }
+
+        pson_container& operator=(pson_container&& other){
+            if(this!=&other){
+                clear();
+                take(other);
             }
-            return size;
+            return *this;
+        }
+
+        size_t size() const{
+            return count_;
         }
 
         T* operator[](size_t index){
+            invalidate_encoded_size();
+            if(index>=count_) return NULL;
+            if(index==count_-1) return &last_->item_;
             list_item* current = item_;
-            size_t current_index = 0;
-            while(current!=NULL){
-                if(current_index==index){
-                    return &current->item_;
-                }
-                current = current->next_;
-                current_index++;
-            }
-            return NULL;
+            while(index-->0) current = current->next_;
+            return &current->item_;
         }
 
         void clear(){
-            while(last_!=NULL){
-                list_item* previous = last_->previous_;
-                pool.destroy(last_);
-                last_ = previous;
+            invalidate_encoded_size();
+            while(item_!=NULL){
+                list_item* next = item_->next_;
+                pool.destroy(item_);
+                item_ = next;
             }
+            last_ = NULL;
+            count_ = 0;
         }
 
         T* create_item(){
-            list_item* new_list_item = pool.allocate<list_item>();
+            invalidate_encoded_size();
+            if(count_==(PSON_CONTAINER_SIZE_TYPE)-1) return NULL;
+            list_item* new_list_item = pool.allocate<list_item>(pson_item_node<T>::type);
             if(new_list_item==NULL) return NULL;
             if(item_==NULL){
                 item_ = new_list_item;
             }else{
                 last_->next_ = new_list_item;
-                new_list_item->previous_ = last_;
             }
             last_ = new_list_item;
+            count_++;
             return &(new_list_item->item_);
         }
+
+        /**
+         * Encoded size of the container contents, as computed in a sizing pass of the encoder. It is dropped
+         * when the container is modified or written, so it cannot be outdated in a later encoding.
+         */
+        bool get_encoded_size(size_t& size) const{
+#ifndef PSON_DISABLE_SIZE_CACHE
+            if(encoded_size_!=(size_t)-1){
+                size = encoded_size_;
+                return true;
+            }
+#endif
+            return false;
+        }
+
+        void set_encoded_size(size_t size){
+#ifndef PSON_DISABLE_SIZE_CACHE
+            encoded_size_ = size;
+#endif
+        }
+
+        void invalidate_encoded_size(){
+#ifndef PSON_DISABLE_SIZE_CACHE
+            encoded_size_ = (size_t)-1;
+#endif
+        }
+
+    private:
+        // take the items of other (this container must be empty)
+        void take(pson_container& other){
+            item_ = other.item_;
+            last_ = other.last_;
+            count_ = other.count_;
+            other.item_ = other.last_ = NULL;
+            other.count_ = 0;
+            other.invalidate_encoded_size();
+        }
     };
 
     class pson_object;
@@ -252,21 +465,28 @@ namespace protoson {
             empty_bytes     = 12,
             object_field    = 13,
             array_field     = 14,
-            empty           = 15
+            empty           = 15,
             // a message tag is encoded in a 128-base varint [1-bit][3-bit wire type][4-bit field]
             // we have up to 4 bits (0-15) for encoding fields in the first byte
+            // packed arrays of little endian numbers, encoded with a two bytes tag
+            packed_float_field  = 16,
+            packed_int16_field  = 17,
+            packed_int32_field  = 18,
+            packed_uint8_field  = 19
         };
 
         // interchange two different containers
         static void swap(pson& source, pson& destination){
             // destroy destination container data (if any)
-            destination.~pson();
+            destination.release();
             // override fields
-            destination.value_ = source.value_;
+            memcpy(destination.inline_, source.inline_, sizeof(inline_));
             destination.field_type_ = source.field_type_;
+            destination.flags_ |= source.flags_ & inline_value;
             // 'clear' source container
-            source.value_ = NULL;
+            memset(source.inline_, 0, sizeof(inline_));
             source.field_type_ = empty;
+            source.flags_ &= ~inline_value;
         }
 
         bool is_boolean() const{
@@ -310,6 +530,10 @@ namespace protoson {
             return field_type_ == array_field;
         }
 
+        bool is_packed() const{
+            return field_type_ >= packed_float_field && field_type_ <= packed_uint8_field;
+        }
+
         bool is_null() const{
             return field_type_ == null_field;
         }
@@ -318,26 +542,35 @@ namespace protoson {
             return field_type_ == empty;
         }
 
-        pson() : value_(NULL), field_type_(empty) {
+        pson() : field_type_(empty), flags_(0) {
+            memset(inline_, 0, sizeof(inline_));
         }
 
         template<class T>
-        pson(T value) : value_(NULL), field_type_(empty){
+        pson(T value) : field_type_(empty), flags_(0){
+            memset(inline_, 0, sizeof(inline_));
             *this = value;
         }
 
         ~pson(){
-            if(field_type_==object_field){
-                pool.destroy((pson_object *) value_);
-            }else if(field_type_==array_field) {
-                pool.destroy((pson_array *) value_);
-            }else{
-                pool.deallocate(value_);
-            }
-            value_ = NULL;
+            release();
             field_type_ = empty;
         }
 
+        // copies are shallow, as they have always been. Move the value to transfer it to another pson
+        pson(const pson& other) = default;
+        pson& operator=(const pson& other) = default;
+
+        pson(pson&& other) : field_type_(empty), flags_(0){
+            memset(inline_, 0, sizeof(inline_));
+            swap(other, *this);
+        }
+
+        pson& operator=(pson&& other){
+            if(this!=&other) swap(other, *this);
+            return *this;
+        }
+
         template<class T>
         void operator=(T value)
         {
@@ -384,7 +617,7 @@ namespace protoson {
             if(str_size==0){
                 field_type_ = empty_string;
             }else if(allocate(str_size+1)){
-                memcpy(value_, str, str_size+1);
+                memcpy(get_value(), str, str_size+1);
                 field_type_ = string_field;
             }
         }
@@ -394,7 +627,7 @@ namespace protoson {
                 size_t varint_size = get_varint_size(size);
                 if(allocate(varint_size+size)){
                     pb_encode_varint(size);
-                    memcpy(((uint8_t*)value_)+varint_size, bytes, size);
+                    memcpy(((uint8_t*)get_value())+varint_size, bytes, size);
                     field_type_ = bytes_field;
                 }
             }else{
@@ -406,7 +639,7 @@ namespace protoson {
             switch(field_type_){
                 case bytes_field:
                     size = pb_decode_varint();
-                    bytes = (uint8_t*) value_ + get_varint_size(size);
+                    bytes = (uint8_t*) get_value() + get_varint_size(size);
                     return true;
                 case empty:
                     field_type_ = empty_bytes;
@@ -416,8 +649,88 @@ namespace protoson {
             }
         }
 
+        /**
+         * Set a packed array from a C array. By default the values are referenced without copying them, so they
+         * must remain valid until the pson is encoded or destroyed. Use copy=true to store a copy of the values.
+         */
+        void set_packed(const float* values, size_t count, bool copy=false){
+            set_packed(packed_float_field, values, count, copy);
+        }
+
+        void set_packed(const int16_t* values, size_t count, bool copy=false){
+            set_packed(packed_int16_field, values, count, copy);
+        }
+
+        void set_packed(const int32_t* values, size_t count, bool copy=false){
+            set_packed(packed_int32_field, values, count, copy);
+        }
+
+        void set_packed(const uint8_t* values, size_t count, bool copy=false){
+            set_packed(packed_uint8_field, values, count, copy);
+        }
+
+        bool get_packed(const float*& values, size_t& count){
+            return get_packed(packed_float_field, (const void*&) values, count);
+        }
+
+        bool get_packed(const int16_t*& values, size_t& count){
+            return get_packed(packed_int16_field, (const void*&) values, count);
+        }
+
+        bool get_packed(const int32_t*& values, size_t& count){
+            return get_packed(packed_int32_field, (const void*&) values, count);
+        }
+
+        bool get_packed(const uint8_t*& values, size_t& count){
+            return get_packed(packed_uint8_field, (const void*&) values, count);
+        }
+
+        /**
+         * Allocate a packed array of the given type and size in bytes, returning the memory for its values
+         */
+        void* allocate_packed(field_type type, size_t size){
+            // never inline, as the header may point to the values stored after it
+            if(!allocate_pool(sizeof(packed_array) + size)) return NULL;
+            packed_array* packed = (packed_array*) get_value();
+            packed->data_ = packed + 1;
+            packed->count_ = size / packed_element_size(type);
+            field_type_ = type;
+            return packed + 1;
+        }
+
+        const void* get_packed_data() const{
+            return is_packed() && get_value()!=NULL ? ((const packed_array*) get_value())->data_ : NULL;
+        }
+
+        size_t get_packed_count() const{
+            return is_packed() && get_value()!=NULL ? ((const packed_array*) get_value())->count_ : 0;
+        }
+
+        static uint8_t packed_element_size(field_type type){
+            switch(type){
+                case packed_int16_field:
+                    return 2;
+                case packed_uint8_field:
+                    return 1;
+                default:
+                    return 4;
+            }
+        }
+
         bool allocate(size_t size){
-            if(value_ == NULL){
+            if(value_ == NULL && !(flags_ & inline_value)){
+                // small values are kept in place, without using the memory pool
+                if(size<=PSON_INLINE_SIZE){
+                    flags_ |= inline_value;
+                    return true;
+                }
+                return allocate_pool(size);
+            }
+            return false;
+        }
+
+        bool allocate_pool(size_t size){
+            if(value_ == NULL && !(flags_ & inline_value)){
                 value_ = pool.allocate(size);
                 return value_!=NULL;
             }
@@ -426,7 +739,7 @@ namespace protoson {
 
         template <class T>
         bool allocate(){
-            if(value_ == NULL){
+            if(value_ == NULL && !(flags_ & inline_value)){
                 value_ = pool.allocate<T>();
                 return value_!=NULL;
             }
@@ -437,10 +750,16 @@ namespace protoson {
         operator pson_array &();
         pson & operator[](const char *name);
 
+        /**
+         * Access a member of this value as an object, referencing the key without copying it, so it must outlive
+         * the object.
+         */
+        pson & borrow(const char *name);
+
         operator const char *() {
             switch(field_type_){
                 case string_field:
-                    return (const char*) value_;
+                    return (const char*) get_value();
                 case empty:
                     field_type_ = empty_string;
                     return "";
@@ -520,9 +839,9 @@ namespace protoson {
                 case true_field:
                     return 1;
                 case float_field:
-                    return *(float*)value_;
+                    return get_fixed<float>();
                 case double_field:
-                    return *(double*)value_;
+                    return get_fixed<double>();
                 case varint_field:
                     return pb_decode_varint();
                 case svarint_field:
@@ -536,11 +855,15 @@ namespace protoson {
         }
 
         void* get_value(){
-            return value_;
+            return flags_ & inline_value ? (void*) inline_ : value_;
+        }
+
+        const void* get_value() const{
+            return flags_ & inline_value ? (const void*) inline_ : value_;
         }
 
         field_type get_type() const{
-            return field_type_;
+            return (field_type) field_type_;
         }
 
         void set_null(){
@@ -566,19 +889,20 @@ namespace protoson {
                 uint8_t byte = (uint8_t)(value & 0x7F);
                 value >>= 7;
                 if(value) byte |= 0x80;
-                ((uint8_t*)value_)[count] = byte;
+                ((uint8_t*)get_value())[count] = byte;
                 count++;
             }while(value);
         }
 
         uint64_t pb_decode_varint() const
         {
-            if(value_==NULL) return 0;
+            const uint8_t* data = (const uint8_t*) get_value();
+            if(data==NULL) return 0;
             uint64_t value = 0;
             uint8_t pos = 0;
             uint8_t byte = 0;
             do{
-                byte = ((uint8_t*)value_)[pos];
+                byte = data[pos];
                 value |= (uint64_t)(byte&0x7F) << pos*7;
                 pos++;
             }while(byte>=0x80);
@@ -604,14 +928,73 @@ namespace protoson {
 #endif
 
     private:
-        void* value_;
-        field_type field_type_;
+        enum flag{
+            // the value is stored in inline_ instead of being allocated in the pool
+            inline_value = 1
+        };
+
+        union{
+            void* value_;
+            uint8_t inline_[PSON_INLINE_SIZE > sizeof(void*) ? PSON_INLINE_SIZE : sizeof(void*)];
+        };
+        uint8_t field_type_;
+        uint8_t flags_;
 
         template<class T>
         void set(T value) {
             if(allocate(sizeof(T))){
-                memcpy(value_, &value, sizeof(T));
+                memcpy(get_value(), &value, sizeof(T));
+            }
+        }
+
+        // packed values are kept after this header, or referenced from the source array
+        struct packed_array{
+            const void* data_;
+            size_t count_;
+        };
+
+        void set_packed(field_type type, const void* values, size_t count, bool copy){
+            size_t size = count * packed_element_size(type);
+            if(copy){
+                if(void* data = allocate_packed(type, size)){
+                    memcpy(data, values, size);
+                }
+            }else if(allocate_pool(sizeof(packed_array))){
+                packed_array* packed = (packed_array*) get_value();
+                packed->data_ = values;
+                packed->count_ = count;
+                field_type_ = type;
+            }
+        }
+
+        bool get_packed(field_type type, const void*& values, size_t& count){
+            if(field_type_!=type || get_value()==NULL) return false;
+            const packed_array* packed = (const packed_array*) get_value();
+            values = packed->data_;
+            count = packed->count_;
+            return true;
+        }
+
+        // inline values are not aligned for the type, so read them byte by byte
+        template<class T>
+        T get_fixed() const{
+            T value;
+            memcpy(&value, get_value(), sizeof(T));
+            return value;
+        }
+
+        // free the current value, keeping the field type
+        void release(){
+            if(flags_ & inline_value){
+                flags_ &= ~inline_value;
+            }else if(field_type_==object_field){
+                pool.destroy((pson_object *) value_);
+            }else if(field_type_==array_field) {
+                pool.destroy((pson_array *) value_);
+            }else{
+                pool.deallocate(value_);
             }
+            memset(inline_, 0, sizeof(inline_));
         }
     };
 
@@ -619,12 +1002,16 @@ namespace protoson {
     private:
         char* name_;
         pson value_;
+        // the name is referenced, not owned by the pair
+        bool borrowed_;
     public:
-        pson_pair() : name_(NULL){
+        pson_pair() : name_(NULL), borrowed_(false){
         }
 
         ~pson_pair(){
-            pool.deallocate(name_);
+            if(!borrowed_){
+                pool.deallocate(name_);
+            }
         }
 
         void set_name(const char *name) {
@@ -634,6 +1021,12 @@ namespace protoson {
             }
         }
 
+        // reference the name without copying it, so it must outlive the pair
+        void borrow_name(const char *name) {
+            name_ = (char*) name;
+            borrowed_ = true;
+        }
+
         char* allocate_name(size_t size){
             name_ = (char*)pool.allocate(size);
             return name_;
@@ -651,69 +1044,444 @@ namespace protoson {
     class pson_object : public pson_container<pson_pair> {
     public:
 
+#if PSON_OBJECT_INDEX_THRESHOLD > 0
+        pson_object() : index_(NULL){
+        }
+
+        ~pson_object(){
+            drop_index();
+        }
+
+        pson_object(pson_object&& other) : pson_container<pson_pair>(static_cast<pson_container<pson_pair>&&>(other)), index_(other.index_){
+            other.index_ = NULL;
+        }
+
+        pson_object& operator=(pson_object&& other){
+            if(this!=&other){
+                drop_index();
+                pson_container<pson_pair>::operator=(static_cast<pson_container<pson_pair>&&>(other));
+                index_ = other.index_;
+                other.index_ = NULL;
+            }
+            return *this;
+        }
+
+        void clear(){
+            drop_index();
+            pson_container<pson_pair>::clear();
+        }
+#endif
+
         pson &operator[](const char *name) {
-            for(iterator it=begin(); it.valid(); it.next()){
-                const char* item_name = it.item().name();
-                if(item_name && strcmp(item_name, name)==0){
-                    return it.item().value();
-                }
+            return get(name, false);
+        }
+
+        /**
+         * Get the member with the given name, creating it if required. The name is referenced without copying
+         * it, so it must outlive the object.
+         */
+        pson &borrow(const char *name) {
+            return get(name, true);
+        }
+
+    private:
+        pson &get(const char *name, bool borrow_name) {
+            invalidate_encoded_size();
+            if(pson_pair* pair = find(name)){
+                return pair->value();
             }
             if(pson_pair* pair = create_item()){
-                pair->set_name(name);
+                if(borrow_name){
+                    pair->borrow_name(name);
+                }else{
+                    pair->set_name(name);
+                }
                 return pair->value();
             }else{
                 static pson value;
                 return value;
             }
+        }
+
+        pson_pair* find(const char *name) {
+#if PSON_OBJECT_INDEX_THRESHOLD > 0
+            if(index_!=NULL && update_index()){
+                if(pson_pair* pair = find_indexed(name, hash(name))) return pair;
+                // items from an unnamed one onwards wait to be indexed until it gets its name
+                for(list_item* current=unindexed(); current!=NULL; current=current->next_){
+                    const char* item_name = current->item_.name();
+                    if(item_name && strcmp(item_name, name)==0) return &current->item_;
+                }
+                return NULL;
+            }
+            size_t count = 0;
+#endif
+            for(list_item* current=item_; current!=NULL; current=current->next_){
+                const char* item_name = current->item_.name();
+                if(item_name && strcmp(item_name, name)==0){
+#if PSON_OBJECT_INDEX_THRESHOLD > 0
+                    if(count>=PSON_OBJECT_INDEX_THRESHOLD) build_index();
+#endif
+                    return &current->item_;
+                }
+#if PSON_OBJECT_INDEX_THRESHOLD > 0
+                count++;
+#endif
+            }
+#if PSON_OBJECT_INDEX_THRESHOLD > 0
+            if(count>=PSON_OBJECT_INDEX_THRESHOLD) build_index();
+#endif
+            return NULL;
+        }
+
+#if PSON_OBJECT_INDEX_THRESHOLD > 0
+        struct index_slot{
+            pson_pair* pair_;
+            uint16_t hash_;
         };
-    };
 
-    class pson_array : public pson_container<pson> {
-    public:
-        template<class T>
-        pson_array& add(T item_value){
-            pson* item = create_item();
-            if(item!=NULL){
-                *item = item_value;
+        /*
+         * Open addressing hash table over the object keys. Items are added to the index lazily in the next
+         * lookup, as the decoder creates the items before setting their names.
+         */
+        struct key_index{
+            list_item* last_;       // last item added to the index
+            uint16_t capacity_;     // always a power of two
+            uint16_t count_;
+            index_slot slots_[1];
+        };
+
+        key_index* index_;
+
+        static uint16_t hash(const char* name){
+            // FNV-1a folded to 16 bits
+            uint32_t hash = 2166136261U;
+            while(*name){
+                hash ^= (uint8_t) *name++;
+                hash *= 16777619U;
             }
-            return *this;
+            return (uint16_t)(hash ^ (hash >> 16));
         }
-    };
 
-    inline pson::operator pson_object &() {
-        if (field_type_ != object_field) {
-            value_ = pool.allocate<pson_object>();
-            field_type_ = value_ != NULL ? object_field : empty;
+        pson_pair* find_indexed(const char* name, uint16_t name_hash){
+            uint16_t mask = index_->capacity_ - 1;
+            for(uint16_t pos = name_hash & mask; index_->slots_[pos].pair_!=NULL; pos = (pos + 1) & mask){
+                index_slot& slot = index_->slots_[pos];
+                if(slot.hash_==name_hash && strcmp(slot.pair_->name(), name)==0){
+                    return slot.pair_;
+                }
+            }
+            return NULL;
         }
-        if(value_!=NULL && field_type_ == object_field){
-            return *((pson_object *)value_);
-        }else{
-            static pson_object dummy;
-            return dummy;
+
+        bool allocate_index(uint16_t capacity){
+            size_t size = sizeof(key_index) + (capacity - 1) * sizeof(index_slot);
+            key_index* index = (key_index*) pool.allocate(size);
+            if(index==NULL) return false;
+            memset(index, 0, size);
+            index->capacity_ = capacity;
+            index_ = index;
+            return true;
         }
-    }
 
-    inline pson::operator pson_array &() {
-        if (field_type_ != array_field) {
-            value_ = pool.allocate<pson_array>();
-            field_type_ = value_!=NULL ? array_field : empty;
+        static void insert(key_index* index, pson_pair* pair, uint16_t pair_hash){
+            uint16_t mask = index->capacity_ - 1;
+            uint16_t pos = pair_hash & mask;
+            while(index->slots_[pos].pair_!=NULL) pos = (pos + 1) & mask;
+            index->slots_[pos].pair_ = pair;
+            index->slots_[pos].hash_ = pair_hash;
+            index->count_++;
+        }
+
+        bool insert(pson_pair* pair){
+            // keep the load factor under 3/4
+            if((index_->count_ + 1) * 4 > index_->capacity_ * 3){
+                if(index_->capacity_>=0x8000) return false;
+                key_index* old_index = index_;
+                if(!allocate_index(old_index->capacity_ * 2)) return false;
+                index_->last_ = old_index->last_;
+                for(uint16_t i=0; i<old_index->capacity_; i++){
+                    if(old_index->slots_[i].pair_!=NULL){
+                        insert(index_, old_index->slots_[i].pair_, old_index->slots_[i].hash_);
+                    }
+                }
+                pool.deallocate(old_index);
+            }
+            insert(index_, pair, hash(pair->name()));
+            return true;
         }
-        if(value_!=NULL && field_type_==array_field){
-            return *((pson_array *)value_);
-        }else{
-            static pson_array dummy;
-            return dummy;
+
+        // first item not added to the index yet
+        list_item* unindexed(){
+            return index_->last_!=NULL ? index_->last_->next_ : item_;
         }
-    }
+
+        // add the items created since the last lookup, up to the first one without a name yet
+        bool update_index(){
+            for(list_item* current=unindexed(); current!=NULL && current->item_.name()!=NULL; current=current->next_){
+                if(!insert(&current->item_)){
+                    drop_index();
+                    return false;
+                }
+                index_->last_ = current;
+            }
+            return true;
+        }
+
+        void build_index(){
+            uint16_t capacity = 32;
+            while(capacity < PSON_OBJECT_INDEX_THRESHOLD * 2 && capacity < 0x8000) capacity <<= 1;
+            if(allocate_index(capacity)) update_index();
+        }
+
+        void drop_index(){
+            pool.deallocate(index_);
+            index_ = NULL;
+        }
+#endif
+    };
+
+    class pson_array : public pson_container<pson> {
+    public:
+        pson_array() : cursor_(NULL), cursor_index_(0){
+        }
+
+        pson_array(pson_array&& other) : pson_container<pson>(static_cast<pson_container<pson>&&>(other)), cursor_(NULL),
+            cursor_index_(0){
+            other.reset_cursor();
+        }
+
+        pson_array& operator=(pson_array&& other){
+            if(this!=&other){
+                reset_cursor();
+                pson_container<pson>::operator=(static_cast<pson_container<pson>&&>(other));
+                other.reset_cursor();
+            }
+            return *this;
+        }
+
+        void clear(){
+            reset_cursor();
+            pson_container<pson>::clear();
+        }
+
+        /**
+         * Item at the given index. Access continues from the last item accessed by index, so iterating an array
+         * by index does not walk the list from the start for every item.
+         */
+        pson* operator[](size_t index){
+            invalidate_encoded_size();
+            if(index>=count_) return NULL;
+            if(index==count_-1) return &last_->item_;
+            if(cursor_==NULL || cursor_index_>index){
+                cursor_ = item_;
+                cursor_index_ = 0;
+            }
+            while(cursor_index_<index){
+                cursor_ = cursor_->next_;
+                cursor_index_++;
+            }
+            return &cursor_->item_;
+        }
+
+        template<class T>
+        pson_array& add(T item_value){
+            pson* item = create_item();
+            if(item!=NULL){
+                *item = item_value;
+            }
+            return *this;
+        }
+
+    private:
+        void reset_cursor(){
+            cursor_ = NULL;
+            cursor_index_ = 0;
+        }
+
+        list_item* cursor_;
+        PSON_CONTAINER_SIZE_TYPE cursor_index_;
+    };
+
+    inline pson::operator pson_object &() {
+        if (field_type_ != object_field) {
+            release();
+            value_ = pool.allocate<pson_object>(memory_allocator::container_node);
+            field_type_ = value_ != NULL ? object_field : empty;
+        }
+        if(value_!=NULL && field_type_ == object_field){
+            ((pson_object *)value_)->invalidate_encoded_size();
+            return *((pson_object *)value_);
+        }else{
+            static pson_object dummy;
+            return dummy;
+        }
+    }
+
+    inline pson::operator pson_array &() {
+        if (field_type_ != array_field) {
+            release();
+            value_ = pool.allocate<pson_array>(memory_allocator::container_node);
+            field_type_ = value_!=NULL ? array_field : empty;
+        }
+        if(value_!=NULL && field_type_==array_field){
+            ((pson_array *)value_)->invalidate_encoded_size();
+            return *((pson_array *)value_);
+        }else{
+            static pson_array dummy;
+            return dummy;
+        }
+    }
 
     inline pson &pson::operator[](const char *name) {
         return ((pson_object &) *this)[name];
     }
 
+    inline pson &pson::borrow(const char *name) {
+        return ((pson_object &) *this).borrow(name);
+    }
+
+    /*
+     * Pool of fixed-size blocks over a static buffer. Free blocks are linked in a list, so allocating and
+     * releasing a block is O(1) and the memory does not fragment.
+     */
+    template<size_t block_size, size_t blocks>
+    class memory_slab{
+    private:
+        union block{
+            block* next_;
+            uint8_t data_[block_size];
+            void* pointer_alignment_;
+            double double_alignment_;
+        };
+
+        block blocks_[blocks];
+        block* free_;
+        size_t used_;
+        size_t high_water_;
+
+    public:
+        memory_slab() : free_(blocks_), used_(0), high_water_(0){
+            for(size_t i=0; i<blocks-1; i++){
+                blocks_[i].next_ = &blocks_[i+1];
+            }
+            blocks_[blocks-1].next_ = NULL;
+        }
+
+        void* allocate(){
+            if(free_==NULL) return NULL;
+            block* memory = free_;
+            free_ = free_->next_;
+            if(++used_>high_water_) high_water_ = used_;
+            return memory;
+        }
+
+        bool owns(void* ptr) const{
+            return (const block*)ptr>=blocks_ && (const block*)ptr<blocks_+blocks;
+        }
+
+        void deallocate(void* ptr){
+            block* memory = (block*) ptr;
+            memory->next_ = free_;
+            free_ = memory;
+            used_--;
+        }
+
+        size_t used() const{
+            return used_;
+        }
+
+        size_t high_water() const{
+            return high_water_;
+        }
+
+        size_t capacity() const{
+            return blocks;
+        }
+    };
+
+    /*
+     * Allocator with a slab for each pson container node: object pairs, array items and the object/array
+     * containers themselves. Nodes are placed by the node type given on allocation, as their sizes may match.
+     * Any other allocation, or a node not fitting in its exhausted slab, goes to the heap.
+     */
+    template<size_t pair_blocks, size_t item_blocks, size_t container_blocks>
+    class slab_memory_allocator : public memory_allocator{
+    public:
+        typedef memory_slab<sizeof(pson_container<pson_pair>::list_item), pair_blocks> pair_slab;
+        typedef memory_slab<sizeof(pson_container<pson>::list_item), item_blocks> item_slab;
+        static const size_t container_size = sizeof(pson_object) > sizeof(pson_array) ? sizeof(pson_object) : sizeof(pson_array);
+        typedef memory_slab<container_size, container_blocks> container_slab;
+
+    private:
+        pair_slab pairs_;
+        item_slab items_;
+        container_slab containers_;
+        size_t overflows_;
+        dynamic_memory_allocator heap_;
+
+    public:
+        slab_memory_allocator() : overflows_(0){
+        }
+
+        virtual void *allocate(size_t size) {
+            return heap_.allocate(size);
+        }
+
+        virtual void *allocate(size_t size, node_type type) {
+            void* memory = NULL;
+            if(type==pair_node && size<=sizeof(pson_container<pson_pair>::list_item)){
+                memory = pairs_.allocate();
+            }else if(type==item_node && size<=sizeof(pson_container<pson>::list_item)){
+                memory = items_.allocate();
+            }else if(type==container_node && size<=container_size){
+                memory = containers_.allocate();
+            }else{
+                return heap_.allocate(size);
+            }
+            if(memory==NULL){
+                overflows_++;
+                memory = heap_.allocate(size);
+            }
+            return memory;
+        }
+
+        virtual void deallocate(void *ptr) {
+            if(pairs_.owns(ptr)){
+                pairs_.deallocate(ptr);
+            }else if(items_.owns(ptr)){
+                items_.deallocate(ptr);
+            }else if(containers_.owns(ptr)){
+                containers_.deallocate(ptr);
+            }else{
+                heap_.deallocate(ptr);
+            }
+        }
+
+        const pair_slab& pairs() const{
+            return pairs_;
+        }
+
+        const item_slab& items() const{
+            return items_;
+        }
+
+        const container_slab& containers() const{
+            return containers_;
+        }
+
+        // number of container nodes allocated from the heap as its slab was exhausted
+        size_t overflows() const{
+            return overflows_;
+        }
+    };
+
     ////////////////////////////
     /////// PSON_DECODER ///////
     ////////////////////////////
 
+    class pson_listener;
+
     class pson_decoder {
 
     protected:
@@ -724,9 +1492,33 @@ namespace protoson {
             return true;
         }
 
+        /**
+         * Decoders over a memory buffer set it here, so the values are read straight from the buffer instead of
+         * calling read() for every varint byte or field
+         */
+        void set_memory(const void* buffer, size_t size){
+            memory_ = (const uint8_t*) buffer;
+            memory_size_ = size;
+        }
+
+        bool pb_read(void* buffer, size_t size){
+            if(memory_==NULL) return read(buffer, size);
+            if(read_>memory_size_ || size>memory_size_-read_) return false;
+            memcpy(buffer, memory_+read_, size);
+            read_ += size;
+            return true;
+        }
+
+        bool pb_read_byte(uint8_t& byte){
+            if(memory_==NULL) return read(&byte, 1);
+            if(read_>=memory_size_) return false;
+            byte = memory_[read_++];
+            return true;
+        }
+
     public:
 
-        pson_decoder() : read_(0) {
+        pson_decoder() : read_(0), memory_(NULL), memory_size_(0) {
 
         }
 
@@ -752,7 +1544,7 @@ namespace protoson {
             uint8_t byte;
             uint8_t bit_pos = 0;
             do{
-                if(!read(&byte, 1) || bit_pos>=32){
+                if(!pb_read_byte(byte) || bit_pos>=32){
                     return false;
                 }
                 varint |= (uint32_t)(byte&0x7F) << bit_pos;
@@ -767,7 +1559,7 @@ namespace protoson {
             uint8_t byte;
             uint8_t bit_pos = 0;
             do{
-                if(!read(&byte, 1) || bit_pos>=64){
+                if(!pb_read_byte(byte) || bit_pos>=64){
                     return false;
                 }
                 varint |= (uint32_t)(byte&0x7F) << bit_pos;
@@ -777,25 +1569,31 @@ namespace protoson {
         }
 
         bool pb_skip(size_t size){
-            uint8_t byte;
-            bool success = true;
-            for(size_t i=0; i<size && success; i++){
-                success = read(&byte, 1);
+            if(memory_!=NULL){
+                if(read_>memory_size_ || size>memory_size_-read_) return false;
+                read_ += size;
+                return true;
             }
-            return success;
+            uint8_t buffer[16];
+            while(size>0){
+                size_t chunk = size < sizeof(buffer) ? size : sizeof(buffer);
+                if(!read(buffer, chunk)) return false;
+                size -= chunk;
+            }
+            return true;
         }
 
         bool pb_skip_varint(){
             uint8_t byte;
             bool success;
             do{
-                success = read(&byte, 1);
+                success = pb_read_byte(byte);
             }while(byte>0x80 && success);
             return success;
         }
 
         bool pb_read_string(char *str, size_t size){
-            if(str && read(str, size)){
+            if(str && pb_read(str, size)){
                 str[size]=0;
                 return true;
             }
@@ -808,7 +1606,7 @@ namespace protoson {
             uint8_t byte=0;
             uint8_t bytes_read=0;
             do{
-                if(bytes_read==10 || !read(&byte, 1)) return false;
+                if(bytes_read==10 || !pb_read_byte(byte)) return false;
                 temp[bytes_read] = byte;
                 bytes_read++;
             }while(byte>=0x80);
@@ -866,7 +1664,7 @@ namespace protoson {
                     case pson::bytes_field: {
                         uint8_t varint_size = value.get_varint_size(size);
                         if(size<=UINT32_MAX-varint_size && value.allocate(size + varint_size)){
-                            if(read((char*)value.get_value() + varint_size, size)){
+                            if(pb_read((char*)value.get_value() + varint_size, size)){
                                 value.pb_encode_varint(size);
                                 return true;
                             }
@@ -883,6 +1681,15 @@ namespace protoson {
                             return decode(*(pson_array*) value.get_value(), size);
                         }
                         return false;
+                    case pson::packed_float_field:
+                    case pson::packed_int16_field:
+                    case pson::packed_int32_field:
+                    case pson::packed_uint8_field: {
+                        // the values are read in a single contiguous block
+                        if(size % pson::packed_element_size((pson::field_type) field_number)!=0) return false;
+                        void* data = value.allocate_packed((pson::field_type) field_number, size);
+                        return data!=NULL && pb_read(data, size);
+                    }
                     default:
                         return false;
                 }
@@ -892,9 +1699,9 @@ namespace protoson {
                     case pson::varint_field:
                         return pb_read_varint(value);
                     case pson::float_field:
-                        return value.allocate(4) && read(value.get_value(), 4);
+                        return value.allocate(4) && pb_read(value.get_value(), 4);
                     case pson::double_field:
-                        return value.allocate(8) && read(value.get_value(), 8);
+                        return value.allocate(8) && pb_read(value.get_value(), 8);
                     case pson::null_field:
                     case pson::true_field:
                     case pson::false_field:
@@ -909,6 +1716,20 @@ namespace protoson {
                 }
             }
         }
+
+        /**
+         * Decode a value reporting its contents to the listener instead of building a tree, so the memory used
+         * does not depend on the value size.
+         */
+        bool decode(pson_listener& listener);
+
+    private:
+        bool decode_key(pson_listener& listener, size_t size);
+        bool decode_data(pson_listener& listener, pson::field_type type, size_t size);
+        bool decode_scalar(pson_listener& listener, pb_wire_type wire_type, uint32_t field_number);
+
+        const uint8_t* memory_;
+        size_t memory_size_;
     };
 
     ////////////////////////////
@@ -919,15 +1740,36 @@ namespace protoson {
 
     protected:
         size_t written_;
+        // encoder only used for computing sizes, so it does not need to walk already sized submessages
+        bool sizing_;
+
+        explicit pson_encoder(bool sizing) : written_(0), sizing_(sizing) {
+        }
 
         virtual bool write(const void* buffer, size_t size){
             written_+=size;
             return true;
         }
 
+        /**
+         * Encoders writing over contiguous memory can go back to already written bytes, so submessages are
+         * encoded in a single pass, reserving a byte for its size that is patched later with patch_varint.
+         */
+        virtual bool seekable(){
+            return false;
+        }
+
+        /**
+         * Replace the one byte placeholder at the given position with the varint encoding of value, moving
+         * forward the following bytes if the varint requires more than one byte.
+         */
+        virtual bool patch_varint(size_t position, uint64_t value){
+            return false;
+        }
+
     public:
 
-        pson_encoder() : written_(0) {
+        pson_encoder() : written_(0), sizing_(false) {
         }
 
         void reset(){
@@ -938,6 +1780,10 @@ namespace protoson {
             return written_;
         }
 
+        bool is_seekable(){
+            return seekable();
+        }
+
         void pb_encode_tag(pb_wire_type wire_type, uint32_t field_number){
             uint64_t tag = ((uint64_t)field_number << 3) | wire_type;
             pb_encode_varint(tag);
@@ -945,54 +1791,239 @@ namespace protoson {
 
         void pb_encode_varint(uint32_t field, uint64_t value)
         {
-            pb_encode_tag(varint, field);
-            pb_encode_varint(value);
+            pb_encode_tag_varint(varint, field, value);
         }
 
-        uint8_t pb_write_varint(void * buffer)
+        /**
+         * Encode a tag followed by a varint (a varint field, or the length of a length delimited field),
+         * in a single write
+         */
+        void pb_encode_tag_varint(pb_wire_type wire_type, uint32_t field_number, uint64_t value)
         {
-            uint8_t byte=0;
-            uint8_t bytes_written=0;
-            do{
-                byte = *((uint8_t*)buffer + bytes_written);
-                bytes_written++;
-            }while(byte>=0x80);
-            write(buffer, bytes_written);
-            return bytes_written;
+            uint8_t buffer[20];
+            uint8_t size = pb_fill_varint(buffer, ((uint64_t)field_number << 3) | wire_type);
+            size += pb_fill_varint(buffer + size, value);
+            write(buffer, size);
         }
 
-        void pb_encode_varint(uint64_t value)
+        /**
+         * Encode a tag followed by a small raw value (up to 10 bytes), in a single write
+         */
+        void pb_encode_tag_bytes(pb_wire_type wire_type, uint32_t field_number, const void* value, uint8_t value_size)
+        {
+            uint8_t buffer[20];
+            uint8_t size = pb_fill_varint(buffer, ((uint64_t)field_number << 3) | wire_type);
+            memcpy(buffer + size, value, value_size);
+            write(buffer, size + value_size);
+        }
+
+        static uint8_t pb_fill_varint(uint8_t* buffer, uint64_t value)
         {
+            uint8_t size = 0;
             do
             {
                 uint8_t byte = (uint8_t)(value & 0x7F);
                 value >>= 7;
                 if(value>0) byte |= 0x80;
-                write(&byte, 1);
+                buffer[size++] = byte;
             }while(value>0);
+            return size;
+        }
+
+        static uint8_t pb_varint_size(const void * buffer)
+        {
+            uint8_t byte=0;
+            uint8_t size=0;
+            do{
+                byte = *((const uint8_t*)buffer + size);
+                size++;
+            }while(byte>=0x80);
+            return size;
+        }
+
+        uint8_t pb_write_varint(void * buffer)
+        {
+            uint8_t bytes_written = pb_varint_size(buffer);
+            write(buffer, bytes_written);
+            return bytes_written;
+        }
+
+        void pb_encode_varint(uint64_t value)
+        {
+            uint8_t buffer[10];
+            write(buffer, pb_fill_varint(buffer, value));
         }
 
         void pb_encode_string(const char* str, uint32_t field_number){
-            pb_encode_tag(length_delimited, field_number);
-            pb_encode_string(str);
+            if(str!=NULL){
+                size_t string_size = strlen(str);
+                pb_encode_tag_varint(length_delimited, field_number, string_size);
+                write(str, string_size);
+            }else{
+                pb_encode_tag(length_delimited, field_number);
+            }
+        }
+
+        void pb_encode_bytes(const void* bytes, size_t size, uint32_t field_number){
+            pb_encode_tag_varint(length_delimited, field_number, size);
+            write(bytes, size);
         }
 
         void pb_encode_string(const char* str){
             if(str!=NULL){
-                size_t string_size = strlen(str);
-                pb_encode_varint(string_size);
+                pb_encode_name(str, strlen(str));
+            }
+        }
+
+        /**
+         * Encode a string of known size with its length prefix, i.e., an object key
+         */
+        void pb_encode_name(const char* str, size_t string_size){
+            // short strings (most keys) are written together with its length
+            uint8_t buffer[32];
+            uint8_t size = pb_fill_varint(buffer, string_size);
+            if(size + string_size <= sizeof(buffer)){
+                memcpy(buffer + size, str, string_size);
+                write(buffer, size + string_size);
+            }else{
+                write(buffer, size);
                 write(str, string_size);
             }
         }
 
+        /**
+         * Reserve a byte in a seekable encoder for a length prefix, returning its position
+         */
+        size_t pb_reserve_varint(){
+            size_t position = written_;
+            uint8_t placeholder = 0;
+            write(&placeholder, 1);
+            return position;
+        }
+
+        /**
+         * Patch a length prefix reserved with pb_reserve_varint with the bytes written after it
+         */
+        bool pb_patch_varint(size_t position){
+            return patch_varint(position, written_ - position - 1);
+        }
+
+        /**
+         * Encode a packed array as a single block, or as a regular array if the packed fields are not enabled
+         */
+        void pb_encode_packed(pson& value)
+        {
+#ifdef PSON_ENCODE_PACKED_ARRAYS
+            size_t size = value.get_packed_count() * pson::packed_element_size(value.get_type());
+            pb_encode_tag_varint(length_delimited, value.get_type(), size);
+            write(value.get_packed_data(), size);
+#else
+            if(seekable()){
+                pb_encode_tag(length_delimited, pson::array_field);
+                size_t position = pb_reserve_varint();
+                pb_encode_packed_items(value);
+                pb_patch_varint(position);
+            }else{
+                pson_encoder sink(true);
+                sink.pb_encode_packed_items(value);
+                pb_encode_tag_varint(length_delimited, pson::array_field, sink.bytes_written());
+                if(sizing_){
+                    written_ += sink.bytes_written();
+                }else{
+                    pb_encode_packed_items(value);
+                }
+            }
+#endif
+        }
+
+        // encode the packed values as the items of a regular array, as if each value was assigned to a pson
+        void pb_encode_packed_items(pson& value)
+        {
+            const uint8_t* data = (const uint8_t*) value.get_packed_data();
+            size_t count = value.get_packed_count();
+            uint8_t element_size = pson::packed_element_size(value.get_type());
+            for(size_t i=0; i<count; i++, data+=element_size){
+                switch(value.get_type()){
+                    case pson::packed_float_field: {
+                        float number;
+                        memcpy(&number, data, sizeof(number));
+                        if(number==(int32_t)number){
+                            pb_encode_integer((int32_t)number);
+                        }else{
+                            pb_encode_fixed32(pson::float_field, &number);
+                        }
+                        break;
+                    }
+                    case pson::packed_int16_field: {
+                        int16_t number;
+                        memcpy(&number, data, sizeof(number));
+                        pb_encode_integer(number);
+                        break;
+                    }
+                    case pson::packed_int32_field: {
+                        int32_t number;
+                        memcpy(&number, data, sizeof(number));
+                        pb_encode_integer(number);
+                        break;
+                    }
+                    default:
+                        pb_encode_integer(*data);
+                        break;
+                }
+            }
+        }
+
+        // encode an integer with the same representation as assigning it to a pson
+        void pb_encode_integer(int64_t value)
+        {
+            if(value==0){
+                pb_encode_tag(varint, pson::zero_field);
+            }else if(value==1){
+                pb_encode_tag(varint, pson::one_field);
+            }else if(value>0){
+                pb_encode_varint(pson::varint_field, (uint64_t) value);
+            }else{
+                pb_encode_varint(pson::svarint_field, -(uint64_t) value);
+            }
+        }
+
         template<class T>
         void pb_encode_submessage(T& element, uint32_t field_number)
         {
-            pb_encode_tag(length_delimited, field_number);
-            pson_encoder sink;
-            sink.encode(element);
-            pb_encode_varint(sink.bytes_written());
-            encode(element);
+            if(seekable()){
+                pb_encode_tag(length_delimited, field_number);
+                // reserve a byte for the submessage size, and patch it once the submessage is written
+                size_t position = pb_reserve_varint();
+                encode(element);
+                pb_patch_varint(position);
+                element.invalidate_encoded_size();
+            }else{
+                size_t size = pb_submessage_size(element);
+                pb_encode_tag_varint(length_delimited, field_number, size);
+                if(sizing_){
+                    written_ += size;
+                }else{
+                    encode(element);
+                    element.invalidate_encoded_size();
+                }
+            }
+        }
+
+        /**
+         * Size of a submessage, reusing the size cached in the container by a previous sizing pass, so nested
+         * submessages are only walked once to compute its length prefix
+         */
+        template<class T>
+        size_t pb_submessage_size(T& element)
+        {
+            size_t size = 0;
+            if(!element.get_encoded_size(size)){
+                pson_encoder sink(true);
+                sink.encode(element);
+                size = sink.bytes_written();
+                element.set_encoded_size(size);
+            }
+            return size;
         }
 
         void pb_encode_fixed32(void* value){
@@ -1005,14 +2036,12 @@ namespace protoson {
 
         void pb_encode_fixed32(uint32_t field, void*value)
         {
-            pb_encode_tag(fixed_32, field);
-            pb_encode_fixed32(value);
+            pb_encode_tag_bytes(fixed_32, field, value, 4);
         }
 
         void pb_encode_fixed64(uint32_t field, void*value)
         {
-            pb_encode_tag(fixed_64, field);
-            pb_encode_fixed64(value);
+            pb_encode_tag_bytes(fixed_64, field, value, 8);
         }
 
     public:
@@ -1043,14 +2072,15 @@ namespace protoson {
                 case pson::string_field:
                     pb_encode_string((const char*)value.get_value(), pson::string_field);
                     break;
-                case pson::bytes_field:
-                    pb_encode_tag(length_delimited, pson::bytes_field);
-                    write(((const char *) value.get_value()) + pb_write_varint(value.get_value()), value.pb_decode_varint());
+                case pson::bytes_field: {
+                    uint8_t varint_size = pb_varint_size(value.get_value());
+                    pb_encode_tag_bytes(length_delimited, pson::bytes_field, value.get_value(), varint_size);
+                    write(((const char *) value.get_value()) + varint_size, value.pb_decode_varint());
                     break;
+                }
                 case pson::svarint_field:
                 case pson::varint_field:
-                    pb_encode_tag(varint, value.get_type());
-                    pb_write_varint(value.get_value());
+                    pb_encode_tag_bytes(varint, value.get_type(), value.get_value(), pb_varint_size(value.get_value()));
                     break;
                 case pson::float_field:
                     pb_encode_fixed32(pson::float_field, value.get_value());
@@ -1064,12 +2094,1234 @@ namespace protoson {
                 case pson::array_field:
                     pb_encode_submessage(*(pson_array *) value.get_value(), pson::array_field);
                     break;
+                case pson::packed_float_field:
+                case pson::packed_int16_field:
+                case pson::packed_int32_field:
+                case pson::packed_uint8_field:
+                    pb_encode_packed(value);
+                    break;
                 default:
                     pb_encode_tag(varint, value.get_type());
                     break;
             }
         }
     };
+
+    /*
+     * Growable contiguous byte buffer, used by encoders that need to go back over the written data.
+     */
+    class pson_buffer{
+    public:
+        pson_buffer() : data_(NULL), size_(0), capacity_(0), fixed_(false){
+        }
+
+        ~pson_buffer(){
+            release();
+        }
+
+        /**
+         * Use the given memory instead of the heap. It is never grown nor freed, so the buffer cannot hold
+         * more than capacity bytes.
+         */
+        void assign(void* storage, size_t capacity){
+            release();
+            data_ = (uint8_t*) storage;
+            capacity_ = capacity;
+            fixed_ = true;
+        }
+
+        bool reserve(size_t size){
+            if(size<=capacity_) return true;
+            if(fixed_) return false;
+            size_t capacity = capacity_>0 ? capacity_ : 32;
+            while(capacity<size) capacity *= 2;
+            void* data = realloc(data_, capacity);
+            if(data==NULL) return false;
+            data_ = (uint8_t*) data;
+            capacity_ = capacity;
+            return true;
+        }
+
+        bool append(const void* data, size_t size){
+            if(!reserve(size_+size)) return false;
+            memcpy(data_+size_, data, size);
+            size_ += size;
+            return true;
+        }
+
+        // open a gap of the given size at position, moving forward the following bytes
+        bool insert(size_t position, size_t size){
+            if(position>size_ || !reserve(size_+size)) return false;
+            memmove(data_+position+size, data_+position, size_-position);
+            size_ += size;
+            return true;
+        }
+
+        // set the buffer size, i.e., before filling it through data()
+        bool resize(size_t size){
+            if(!reserve(size)) return false;
+            size_ = size;
+            return true;
+        }
+
+        void clear(){
+            size_ = 0;
+        }
+
+        // free the heap memory. Assigned memory is kept
+        void release(){
+            size_ = 0;
+            if(fixed_) return;
+            free(data_);
+            data_ = NULL;
+            capacity_ = 0;
+        }
+
+        uint8_t* data(){
+            return data_;
+        }
+
+        size_t size() const{
+            return size_;
+        }
+
+        size_t capacity() const{
+            return capacity_;
+        }
+
+        // true if the buffer uses assigned memory
+        bool fixed() const{
+            return fixed_;
+        }
+
+        // exchange the contents with other buffer, without copying them
+        void swap(pson_buffer& other){
+            uint8_t* data = data_;
+            size_t size = size_;
+            size_t capacity = capacity_;
+            bool fixed = fixed_;
+            data_ = other.data_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            fixed_ = other.fixed_;
+            other.data_ = data;
+            other.size_ = size;
+            other.capacity_ = capacity;
+            other.fixed_ = fixed;
+        }
+
+    private:
+        // not copyable
+        pson_buffer(const pson_buffer&);
+        pson_buffer& operator=(const pson_buffer&);
+
+        uint8_t* data_;
+        size_t size_;
+        size_t capacity_;
+        bool fixed_;
+    };
+
+    /*
+     * Encoder over a growable memory buffer. Submessages are encoded in a single pass, back-patching its
+     * size, with the same output as the streaming encoder.
+     */
+    class pson_buffer_encoder : public pson_encoder{
+    public:
+        pson_buffer_encoder() : failed_(false){
+        }
+
+        void reset(){
+            buffer_.clear();
+            failed_ = false;
+            pson_encoder::reset();
+        }
+
+        // true if all the data could be written in the buffer (there was enough memory)
+        bool good() const{
+            return !failed_;
+        }
+
+        pson_buffer& get_buffer(){
+            return buffer_;
+        }
+
+    protected:
+        virtual bool write(const void* buffer, size_t size){
+            if(buffer_.append(buffer, size)){
+                return pson_encoder::write(buffer, size);
+            }
+            failed_ = true;
+            return false;
+        }
+
+        virtual bool seekable(){
+            return true;
+        }
+
+        virtual bool patch_varint(size_t position, uint64_t value){
+            uint8_t varint[10];
+            uint8_t size = pb_fill_varint(varint, value);
+            if(position>=buffer_.size() || (size>1 && !buffer_.insert(position+1, size-1))){
+                failed_ = true;
+                return false;
+            }
+            memcpy(buffer_.data()+position, varint, size);
+            written_ += size-1;
+            return true;
+        }
+
+    private:
+        pson_buffer buffer_;
+        bool failed_;
+    };
+
+    ////////////////////////////
+    /////// PSON_WRITER ////////
+    ////////////////////////////
+
+    /**
+     * Writes a value in order, i.e., w.begin_object().key("t").value(21.5f).end_object(), without building a
+     * pson tree. Over a seekable encoder the values go straight to the encoder, back-patching the object and
+     * array sizes, so nothing is allocated. Over a pson, the value is built in the pson as usual. Objects and
+     * arrays cannot be written to other encoders, as their sizes must be known before their contents.
+     */
+    class pson_writer{
+    public:
+        explicit pson_writer(pson_encoder& encoder) : encoder_(&encoder), root_(NULL), key_(NULL), depth_(0), roots_(0), keyed_(false), failed_(false){
+        }
+
+        explicit pson_writer(pson& root) : encoder_(NULL), root_(&root), key_(NULL), depth_(0), roots_(0), keyed_(false), failed_(false){
+        }
+
+        // true if the whole value could be written
+        bool good() const{
+            return !failed_;
+        }
+
+        /**
+         * True if exactly one value was written, and it was written whole, with every object member having
+         * its key and value, and every object and array closed
+         */
+        bool complete() const{
+            return !failed_ && depth_==0 && roots_==1;
+        }
+
+        pson_writer& begin_object(){
+            return begin(pson::object_field);
+        }
+
+        pson_writer& end_object(){
+            return end();
+        }
+
+        pson_writer& begin_array(){
+            return begin(pson::array_field);
+        }
+
+        pson_writer& end_array(){
+            return end();
+        }
+
+        /**
+         * Name of the next object member. It must remain valid until its value is written.
+         */
+        template<class T>
+        pson_writer& key(T name){
+            key_start();
+            if(encoder_!=NULL){
+                encoder_->pb_encode_string(name);
+            }else{
+                key_ = name;
+            }
+            return *this;
+        }
+
+        // the size of string literals is known at compile time
+        template<size_t N>
+        pson_writer& key(const char (&name)[N]){
+            key_start();
+            if(encoder_!=NULL){
+                encoder_->pb_encode_name(name, N-1);
+            }else{
+                key_ = name;
+            }
+            return *this;
+        }
+
+        template<size_t N>
+        pson_writer& key(char (&name)[N]){
+            return key((const char*) name);
+        }
+
+        pson_writer& value(bool value){
+            value_start();
+            if(encoder_!=NULL){
+                encoder_->pb_encode_tag(varint, value ? pson::true_field : pson::false_field);
+            }else if(pson* target = next()){
+                *target = value;
+            }
+            return *this;
+        }
+
+        pson_writer& value(int value){
+            return integer(value<0, value<0 ? -(uint64_t)value : value);
+        }
+
+        pson_writer& value(unsigned int value){
+            return integer(false, value);
+        }
+
+        pson_writer& value(long value){
+            return integer(value<0, value<0 ? -(uint64_t)value : value);
+        }
+
+        pson_writer& value(unsigned long value){
+            return integer(false, value);
+        }
+
+        pson_writer& value(long long value){
+            return integer(value<0, value<0 ? -(uint64_t)value : value);
+        }
+
+        pson_writer& value(unsigned long long value){
+            return integer(false, value);
+        }
+
+        pson_writer& value(float value){
+            // same representation as assigning the value to a pson
+            if(value==(int32_t)value) return this->value((long long)(int32_t)value);
+            value_start();
+            if(encoder_!=NULL){
+                encoder_->pb_encode_fixed32(pson::float_field, &value);
+            }else if(pson* target = next()){
+                *target = value;
+            }
+            return *this;
+        }
+
+        pson_writer& value(double value){
+            if(value==(int64_t)value) return this->value((long long)(int64_t)value);
+            if(fabs(value-(float)value)<=0.00001) return this->value((float)value);
+            value_start();
+            if(encoder_!=NULL){
+                encoder_->pb_encode_fixed64(pson::double_field, &value);
+            }else if(pson* target = next()){
+                *target = value;
+            }
+            return *this;
+        }
+
+        pson_writer& value(const char* str){
+            if(str==NULL) return null();
+            value_start();
+            if(encoder_!=NULL){
+                if(*str==0){
+                    encoder_->pb_encode_tag(varint, pson::empty_string);
+                }else{
+                    encoder_->pb_encode_string(str, pson::string_field);
+                }
+            }else if(pson* target = next()){
+                *target = str;
+            }
+            return *this;
+        }
+
+        /**
+         * String of the given size, that does not need to be NUL terminated
+         */
+        pson_writer& value(const char* str, size_t size){
+            value_start();
+            if(encoder_!=NULL){
+                if(size==0){
+                    encoder_->pb_encode_tag(varint, pson::empty_string);
+                }else{
+                    encoder_->pb_encode_bytes(str, size, pson::string_field);
+                }
+            }else if(pson* target = next()){
+                if(size==0){
+                    target->set_type(pson::empty_string);
+                }else if(target->allocate(size+1)){
+                    memcpy(target->get_value(), str, size);
+                    ((char*) target->get_value())[size] = 0;
+                    target->set_type(pson::string_field);
+                }
+            }
+            return *this;
+        }
+
+        pson_writer& bytes(const void* bytes, size_t size){
+            value_start();
+            if(encoder_!=NULL){
+                if(size==0){
+                    encoder_->pb_encode_tag(varint, pson::empty_bytes);
+                }else{
+                    encoder_->pb_encode_bytes(bytes, size, pson::bytes_field);
+                }
+            }else if(pson* target = next()){
+                target->set_bytes((void*) bytes, size);
+            }
+            return *this;
+        }
+
+        /**
+         * End any object or array left open
+         */
+        void close(){
+            while(depth_>0) end();
+        }
+
+        pson_writer& null(){
+            value_start();
+            if(encoder_!=NULL){
+                encoder_->pb_encode_tag(varint, pson::null_field);
+            }else if(pson* target = next()){
+                target->set_null();
+            }
+            return *this;
+        }
+
+    private:
+        pson_writer& integer(bool negative, uint64_t value){
+            value_start();
+            if(encoder_!=NULL){
+                if(value==0){
+                    encoder_->pb_encode_tag(varint, pson::zero_field);
+                }else if(value==1 && !negative){
+                    encoder_->pb_encode_tag(varint, pson::one_field);
+                }else{
+                    encoder_->pb_encode_varint(negative ? pson::svarint_field : pson::varint_field, value);
+                }
+            }else if(pson* target = next()){
+                if(negative){
+                    *target = -(int64_t) value;
+                }else{
+                    *target = value;
+                }
+            }
+            return *this;
+        }
+
+        pson_writer& begin(pson::field_type type){
+            if(depth_==PSON_WRITER_MAX_DEPTH || (encoder_!=NULL && !encoder_->is_seekable())){
+                failed_ = true;
+                return *this;
+            }
+            value_start();
+            if(encoder_!=NULL){
+                encoder_->pb_encode_tag(length_delimited, type);
+                levels_[depth_].object = type==pson::object_field;
+                levels_[depth_++].position = encoder_->pb_reserve_varint();
+            }else if(pson* target = next()){
+                // converting the pson allocates the container
+                if(type==pson::object_field){
+                    static_cast<void>((pson_object&) *target);
+                }else{
+                    static_cast<void>((pson_array&) *target);
+                }
+                // the container could not be allocated
+                if(target->get_type()!=type){
+                    failed_ = true;
+                    return *this;
+                }
+                levels_[depth_].object = type==pson::object_field;
+                levels_[depth_++].node = target;
+            }
+            return *this;
+        }
+
+        pson_writer& end(){
+            // a key without its value
+            if(keyed_) failed_ = true;
+            keyed_ = false;
+            if(depth_==0){
+                failed_ = true;
+            }else if(encoder_!=NULL){
+                if(!encoder_->pb_patch_varint(levels_[--depth_].position)) failed_ = true;
+            }else{
+                --depth_;
+            }
+            return *this;
+        }
+
+        // values at the root are counted up to two, and object members need a key
+        void value_start(){
+            if(depth_==0){
+                if(roots_<2) ++roots_;
+            }else if(levels_[depth_-1].object){
+                if(!keyed_) failed_ = true;
+                keyed_ = false;
+            }
+        }
+
+        // keys are only valid inside objects, once per member
+        void key_start(){
+            if(depth_==0 || !levels_[depth_-1].object || keyed_) failed_ = true;
+            keyed_ = true;
+        }
+
+        // pson receiving the next value when building a tree
+        pson* next(){
+            pson* target = NULL;
+            if(depth_==0){
+                target = root_;
+            }else{
+                pson* container = levels_[depth_-1].node;
+                if(levels_[depth_-1].object){
+                    target = key_!=NULL ? &((pson_object&) *container)[key_] : NULL;
+                    key_ = NULL;
+                }else{
+                    target = ((pson_array&) *container).create_item();
+                }
+            }
+            if(target==NULL) failed_ = true;
+            return target;
+        }
+
+        struct level{
+            union{
+                size_t position;
+                pson* node;
+            };
+            bool object;
+        };
+
+        pson_encoder* encoder_;
+        pson* root_;
+        const char* key_;
+        level levels_[PSON_WRITER_MAX_DEPTH];
+        uint8_t depth_;
+        uint8_t roots_;
+        bool keyed_;
+        bool failed_;
+    };
+
+    /*
+     * Decoder reading from a memory buffer.
+     */
+    class pson_memory_decoder : public pson_decoder{
+    public:
+        pson_memory_decoder(const void* buffer, size_t size) : buffer_((const uint8_t*) buffer), size_(size){
+            set_memory(buffer, size);
+        }
+
+    protected:
+        virtual bool read(void* buffer, size_t size){
+            if(read_+size<=size_){
+                memcpy(buffer, buffer_ + read_, size);
+                return pson_decoder::read(buffer, size);
+            }
+            return false;
+        }
+
+    private:
+        const uint8_t* buffer_;
+        size_t size_;
+    };
+
+    //////////////////////////
+    /////// PSON_VIEW ////////
+    //////////////////////////
+
+    /**
+     * Read-only view over an encoded pson value held in a memory buffer, i.e., a received frame. Nothing is
+     * allocated: strings and bytes are returned as pointers into the buffer (strings are not NUL terminated),
+     * and numbers are decoded on access. The buffer must outlive the view. Every read is bounds checked, so a
+     * malformed buffer results in an empty view.
+     */
+    class pson_view{
+    public:
+
+        /**
+         * Iterator over the items of an array, or the members of an object.
+         */
+        class iterator{
+        public:
+            iterator(const uint8_t* begin, const uint8_t* end, bool object) :
+                    current_(begin), end_(end), object_(object), name_(NULL), name_size_(0), value_(NULL), value_size_(0){
+                load();
+            }
+
+            bool valid() const{
+                return value_!=NULL;
+            }
+
+            bool next(){
+                if(!valid()) return false;
+                current_ = value_ + value_size_;
+                load();
+                return valid();
+            }
+
+            pson_view value() const{
+                return pson_view(value_, value_size_);
+            }
+
+            /**
+             * Name of the current object member, pointing into the buffer. NULL for array items.
+             */
+            const char* name(size_t& size) const{
+                size = name_size_;
+                return name_;
+            }
+
+            bool name_equals(const char* name) const{
+                size_t size = strlen(name);
+                return name_!=NULL && size==name_size_ && memcmp(name_, name, size)==0;
+            }
+
+        private:
+            void load(){
+                value_ = NULL;
+                value_size_ = 0;
+                if(current_==NULL || current_>=end_) return;
+                const uint8_t* value = current_;
+                if(object_){
+                    uint64_t size;
+                    value = read_varint(current_, end_, size);
+                    if(value==NULL || size>(uint64_t)(end_-value)) return;
+                    name_ = (const char*) value;
+                    name_size_ = (size_t) size;
+                    value += size;
+                }
+                if(value<end_){
+                    value_size_ = pson_view(value, end_-value).encoded_size();
+                    if(value_size_>0) value_ = value;
+                }
+            }
+
+            const uint8_t* current_;
+            const uint8_t* end_;
+            bool object_;
+            const char* name_;
+            size_t name_size_;
+            const uint8_t* value_;
+            size_t value_size_;
+        };
+
+        pson_view() : data_(NULL), size_(0){
+        }
+
+        pson_view(const void* data, size_t size) : data_((const uint8_t*) data), size_(size){
+        }
+
+        bool valid() const{
+            return data_!=NULL && size_>0;
+        }
+
+        /**
+         * Size of the encoded value (tag included), or 0 if the buffer does not hold a well formed value.
+         */
+        size_t encoded_size() const{
+            uint32_t field;
+            const uint8_t* content;
+            size_t size;
+            return parse(field, content, size) ? (content + size) - data_ : 0;
+        }
+
+        pson::field_type get_type() const{
+            uint32_t field;
+            const uint8_t* content;
+            size_t size;
+            return parse(field, content, size) ? (pson::field_type) field : pson::empty;
+        }
+
+        bool is_boolean() const{
+            pson::field_type type = get_type();
+            return type==pson::true_field || type==pson::false_field;
+        }
+
+        bool is_number() const{
+            switch(get_type()){
+                case pson::varint_field:
+                case pson::svarint_field:
+                case pson::float_field:
+                case pson::double_field:
+                case pson::zero_field:
+                case pson::one_field:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        bool is_string() const{
+            pson::field_type type = get_type();
+            return type==pson::string_field || type==pson::empty_string;
+        }
+
+        bool is_bytes() const{
+            pson::field_type type = get_type();
+            return type==pson::bytes_field || type==pson::empty_bytes;
+        }
+
+        bool is_object() const{
+            return get_type()==pson::object_field;
+        }
+
+        bool is_array() const{
+            return get_type()==pson::array_field;
+        }
+
+        bool is_null() const{
+            return get_type()==pson::null_field;
+        }
+
+        bool is_empty() const{
+            return get_type()==pson::empty;
+        }
+
+        template<class T>
+        T get_value() const{
+            uint32_t field;
+            const uint8_t* content;
+            size_t size;
+            if(!parse(field, content, size)) return 0;
+            switch(field){
+                case pson::one_field:
+                case pson::true_field:
+                    return 1;
+                case pson::float_field:
+                    return get_fixed<float>(content);
+                case pson::double_field:
+                    return get_fixed<double>(content);
+                case pson::varint_field:
+                    return decode_varint(content, size);
+                case pson::svarint_field:
+                    return -(T) decode_varint(content, size);
+                default:
+                    return 0;
+            }
+        }
+
+        operator bool() const{
+            pson::field_type type = get_type();
+            return type==pson::true_field || type==pson::one_field;
+        }
+
+        operator char() const{
+            return get_value<char>();
+        }
+
+        operator unsigned char() const{
+            return get_value<unsigned char>();
+        }
+
+        operator short() const{
+            return get_value<short>();
+        }
+
+        operator unsigned short() const{
+            return get_value<unsigned short>();
+        }
+
+        operator int() const{
+            return get_value<int>();
+        }
+
+        operator unsigned int() const{
+            return get_value<unsigned int>();
+        }
+
+        operator long() const{
+            return get_value<long>();
+        }
+
+        operator unsigned long() const{
+            return get_value<unsigned long>();
+        }
+
+        operator float() const{
+            return get_value<float>();
+        }
+
+        operator double() const{
+            return get_value<double>();
+        }
+
+        /**
+         * String contents pointing into the buffer. Note that it is not NUL terminated. Returns NULL if the
+         * value is not a string.
+         */
+        const char* get_string(size_t& size) const{
+            uint32_t field;
+            const uint8_t* content;
+            if(parse(field, content, size)){
+                switch(field){
+                    case pson::string_field:
+                        return (const char*) content;
+                    case pson::empty_string:
+                        size = 0;
+                        return "";
+                    default:
+                        break;
+                }
+            }
+            size = 0;
+            return NULL;
+        }
+
+        bool equals(const char* str) const{
+            size_t size;
+            const char* value = get_string(size);
+            return value!=NULL && strlen(str)==size && memcmp(value, str, size)==0;
+        }
+
+        /**
+         * Copy the string as a NUL terminated string, truncating it if required. Returns false if the value
+         * is not a string.
+         */
+        bool copy_string(char* buffer, size_t buffer_size) const{
+            size_t size;
+            const char* value = get_string(size);
+            if(value==NULL || buffer_size==0) return false;
+            if(size>=buffer_size) size = buffer_size-1;
+            memcpy(buffer, value, size);
+            buffer[size] = 0;
+            return true;
+        }
+
+        bool get_bytes(const void*& bytes, size_t& size) const{
+            uint32_t field;
+            const uint8_t* content;
+            if(parse(field, content, size)){
+                switch(field){
+                    case pson::bytes_field:
+                        bytes = content;
+                        return true;
+                    case pson::empty_bytes:
+                        bytes = NULL;
+                        size = 0;
+                        return true;
+                    default:
+                        break;
+                }
+            }
+            bytes = NULL;
+            size = 0;
+            return false;
+        }
+
+        /**
+         * Iterator over the array items or object members. Not valid for other types.
+         */
+        iterator begin() const{
+            uint32_t field;
+            const uint8_t* content;
+            size_t size;
+            if(parse(field, content, size) && (field==pson::object_field || field==pson::array_field)){
+                return iterator(content, content+size, field==pson::object_field);
+            }
+            return iterator(NULL, NULL, false);
+        }
+
+        size_t size() const{
+            size_t count = 0;
+            for(iterator it = begin(); it.valid(); it.next()) count++;
+            return count;
+        }
+
+        /**
+         * Object member with the given name, or an empty view if it does not exist.
+         */
+        pson_view operator[](const char* name) const{
+            if(is_object()){
+                for(iterator it = begin(); it.valid(); it.next()){
+                    if(it.name_equals(name)) return it.value();
+                }
+            }
+            return pson_view();
+        }
+
+        /**
+         * Array item (or object member value) at the given position, or an empty view if it does not exist.
+         */
+        pson_view at(size_t index) const{
+            for(iterator it = begin(); it.valid(); it.next()){
+                if(index--==0) return it.value();
+            }
+            return pson_view();
+        }
+
+        /**
+         * Materialize the value in a pson tree.
+         */
+        bool decode(pson& value) const{
+            size_t size = encoded_size();
+            if(size==0) return false;
+            pson_memory_decoder decoder(data_, size);
+            return decoder.decode(value);
+        }
+
+        const uint8_t* data() const{
+            return data_;
+        }
+
+    private:
+        static const uint8_t* read_varint(const uint8_t* data, const uint8_t* end, uint64_t& value){
+            value = 0;
+            for(uint8_t bit_pos = 0; data<end && bit_pos<64; bit_pos+=7){
+                uint8_t byte = *data++;
+                value |= (uint64_t)(byte&0x7F) << bit_pos;
+                if(byte<0x80) return data;
+            }
+            return NULL;
+        }
+
+        static uint64_t decode_varint(const uint8_t* data, size_t size){
+            uint64_t value;
+            read_varint(data, data+size, value);
+            return value;
+        }
+
+        template<class T>
+        static T get_fixed(const uint8_t* data){
+            T value;
+            memcpy(&value, data, sizeof(T));
+            return value;
+        }
+
+        /**
+         * Parse the value header, returning its field type, and the position and size of its contents.
+         */
+        bool parse(uint32_t& field, const uint8_t*& content, size_t& size) const{
+            if(!valid()) return false;
+            const uint8_t* end = data_ + size_;
+            uint64_t tag;
+            content = read_varint(data_, end, tag);
+            if(content==NULL) return false;
+            field = (uint32_t) (tag >> 3);
+            switch((pb_wire_type)(tag & 0x07)){
+                case varint:
+                    size = 0;
+                    if(field==pson::varint_field || field==pson::svarint_field){
+                        uint64_t value;
+                        const uint8_t* next = read_varint(content, end, value);
+                        if(next==NULL) return false;
+                        size = next - content;
+                    }
+                    return true;
+                case fixed_32:
+                    size = 4;
+                    break;
+                case fixed_64:
+                    size = 8;
+                    break;
+                case length_delimited: {
+                    uint64_t length;
+                    content = read_varint(content, end, length);
+                    if(content==NULL || length>(uint64_t)(end-content)) return false;
+                    size = (size_t) length;
+                    return true;
+                }
+                default:
+                    return false;
+            }
+            return (size_t)(end-content)>=size;
+        }
+
+        const uint8_t* data_;
+        size_t size_;
+    };
+    //////////////////////////
+    ///// PSON_LISTENER //////
+    //////////////////////////
+
+    /**
+     * Receives the contents of a value decoded with pson_decoder::decode(pson_listener&), in order, as they
+     * are read. Strings, bytes, and packed arrays are delivered in slices of up to PSON_LISTENER_CHUNK_SIZE
+     * bytes, so arbitrarily large inputs can be processed in constant memory. Object keys longer than a chunk
+     * are truncated.
+     */
+    class pson_listener{
+    public:
+        virtual ~pson_listener(){}
+
+        virtual void on_object_start(){}
+        virtual void on_object_end(){}
+        virtual void on_array_start(){}
+        virtual void on_array_end(){}
+
+        /**
+         * Name of the next object member (NUL terminated).
+         */
+        virtual void on_key(const char* name, size_t size){}
+
+        /**
+         * Number, boolean, null, or empty value. The view is valid only during the call.
+         */
+        virtual void on_value(const pson_view& value){}
+
+        /**
+         * Slice of a string, bytes, or packed array of the given type. Empty values are reported with a single
+         * call of size 0.
+         * @param offset position of the slice in the value
+         * @param total size of the whole value
+         */
+        virtual void on_data(pson::field_type type, const void* data, size_t size, size_t offset, size_t total){}
+    };
+
+    inline bool pson_decoder::decode(pson_listener& listener){
+        uint32_t field_number;
+        pb_wire_type wire_type;
+        if(!pb_decode_tag(wire_type, field_number)) return false;
+        if(wire_type!=length_delimited) return decode_scalar(listener, wire_type, field_number);
+        uint32_t size = 0;
+        if(!pb_decode_varint32(size)) return false;
+        switch(field_number){
+            case pson::object_field: {
+                listener.on_object_start();
+                size_t start_read = bytes_read();
+                while(size-(bytes_read()-start_read)>0){
+                    uint32_t name_size;
+                    if(!pb_decode_varint32(name_size) || !decode_key(listener, name_size) || !decode(listener)) return false;
+                }
+                listener.on_object_end();
+                return true;
+            }
+            case pson::array_field: {
+                listener.on_array_start();
+                size_t start_read = bytes_read();
+                while(size-(bytes_read()-start_read)>0){
+                    if(!decode(listener)) return false;
+                }
+                listener.on_array_end();
+                return true;
+            }
+            case pson::string_field:
+            case pson::bytes_field:
+            case pson::packed_float_field:
+            case pson::packed_int16_field:
+            case pson::packed_int32_field:
+            case pson::packed_uint8_field:
+                return decode_data(listener, (pson::field_type) field_number, size);
+            default:
+                return false;
+        }
+    }
+
+    inline bool pson_decoder::decode_key(pson_listener& listener, size_t size){
+        char name[PSON_LISTENER_CHUNK_SIZE];
+        size_t name_size = size < sizeof(name) ? size : sizeof(name)-1;
+        if(!pb_read_string(name, name_size) || !pb_skip(size-name_size)) return false;
+        listener.on_key(name, name_size);
+        return true;
+    }
+
+    inline bool pson_decoder::decode_data(pson_listener& listener, pson::field_type type, size_t size){
+        uint8_t chunk[PSON_LISTENER_CHUNK_SIZE];
+        size_t offset = 0;
+        do{
+            size_t chunk_size = size-offset < sizeof(chunk) ? size-offset : sizeof(chunk);
+            if(!pb_read(chunk, chunk_size)) return false;
+            listener.on_data(type, chunk, chunk_size, offset, size);
+            offset += chunk_size;
+        }while(offset<size);
+        return true;
+    }
+
+    inline bool pson_decoder::decode_scalar(pson_listener& listener, pb_wire_type wire_type, uint32_t field_number){
+        // the value is encoded again in a small buffer, so it can be read with a view
+        uint8_t value[16];
+        uint32_t tag = (field_number << 3) | wire_type;
+        size_t size = 0;
+        do{
+            value[size++] = (uint8_t)(tag & 0x7F) | (tag>0x7F ? 0x80 : 0);
+            tag >>= 7;
+        }while(tag>0);
+        switch(field_number){
+            case pson::svarint_field:
+            case pson::varint_field:
+                do{
+                    if(size==sizeof(value) || !pb_read_byte(value[size])) return false;
+                }while(value[size++]>=0x80);
+                break;
+            case pson::float_field:
+                if(!pb_read(value+size, 4)) return false;
+                size += 4;
+                break;
+            case pson::double_field:
+                if(!pb_read(value+size, 8)) return false;
+                size += 8;
+                break;
+            case pson::null_field:
+            case pson::true_field:
+            case pson::false_field:
+            case pson::zero_field:
+            case pson::one_field:
+                break;
+            case pson::empty_string:
+            case pson::empty_bytes:
+                listener.on_data((pson::field_type) field_number, NULL, 0, 0, 0);
+                return true;
+            case pson::empty:
+                break;
+            default:
+                return false;
+        }
+        listener.on_value(pson_view(value, size));
+        return true;
+    }
+    //////////////////////////
+    ////// PSON_SCHEMA ///////
+    //////////////////////////
+
+    /**
+     * Declares the fields of a struct once, so it is encoded and decoded without building a pson tree, i.e.:
+     *
+     *  template<> struct pson_schema<climate>{
+     *      template<class V> static void fields(V& v, climate& value){
+     *          v("temperature", value.temperature);
+     *          v("humidity", value.humidity);
+     *      }
+     *  };
+     *
+     * Fields can be booleans, numbers, char arrays (strings), or structs with its own schema. Keys must be
+     * string literals, as their size is used at compile time for writing and matching them.
+     */
+    template<class T>
+    struct pson_schema;
+
+    /**
+     * Writes the schema fields of a struct as an object
+     */
+    class pson_schema_writer{
+    public:
+        explicit pson_schema_writer(pson_writer& writer) : writer_(writer){
+        }
+
+        template<size_t N, class T>
+        void operator()(const char (&name)[N], T& value){
+            writer_.key(name);
+            write(value);
+        }
+
+        template<class T>
+        void write(T& value){
+            writer_.begin_object();
+            pson_schema<T>::fields(*this, value);
+            writer_.end_object();
+        }
+
+        template<size_t N>
+        void write(char (&value)[N]){
+            // the string may fill the whole array, without terminator
+            size_t size = 0;
+            while(size<N && value[size]!=0) size++;
+            writer_.value((const char*) value, size);
+        }
+
+        void write(bool& value){ writer_.value(value); }
+        void write(char& value){ writer_.value((int) value); }
+        void write(signed char& value){ writer_.value((int) value); }
+        void write(unsigned char& value){ writer_.value((unsigned int) value); }
+        void write(short& value){ writer_.value((int) value); }
+        void write(unsigned short& value){ writer_.value((unsigned int) value); }
+        void write(int& value){ writer_.value(value); }
+        void write(unsigned int& value){ writer_.value(value); }
+        void write(long& value){ writer_.value(value); }
+        void write(unsigned long& value){ writer_.value(value); }
+        void write(long long& value){ writer_.value(value); }
+        void write(unsigned long long& value){ writer_.value(value); }
+        void write(float& value){ writer_.value(value); }
+        void write(double& value){ writer_.value(value); }
+
+    private:
+        pson_writer& writer_;
+    };
+
+    /**
+     * Reads an object member into the schema field with the same name. Keys are compared by its size first,
+     * which is known at compile time, so most fields are discarded without comparing the names.
+     */
+    class pson_schema_reader{
+    public:
+        pson_schema_reader(const char* name, size_t name_size, const pson_view& value) :
+                name_(name), name_size_(name_size), value_(value), matched_(false){
+        }
+
+        template<size_t N, class T>
+        void operator()(const char (&name)[N], T& value){
+            if(!matched_ && N-1==name_size_ && memcmp(name, name_, N-1)==0){
+                matched_ = true;
+                read(value_, value);
+            }
+        }
+
+        template<class T>
+        static bool read(const pson_view& view, T& value){
+            if(!view.is_object()) return false;
+            for(pson_view::iterator it = view.begin(); it.valid(); it.next()){
+                size_t name_size;
+                const char* name = it.name(name_size);
+                pson_schema_reader reader(name, name_size, it.value());
+                pson_schema<T>::fields(reader, value);
+            }
+            return true;
+        }
+
+        template<size_t N>
+        static bool read(const pson_view& view, char (&value)[N]){
+            size_t size;
+            const char* str = view.get_string(size);
+            if(str==NULL) return false;
+            // longer strings are truncated, keeping room for the terminator
+            if(size>N-1) size = N-1;
+            memcpy(value, str, size);
+            value[size] = 0;
+            return true;
+        }
+
+        static bool read(const pson_view& view, bool& value){
+            if(!view.is_boolean() && !view.is_number()) return false;
+            value = view.get_value<double>()!=0;
+            return true;
+        }
+
+        template<class T>
+        static bool read_number(const pson_view& view, T& value){
+            if(!view.is_number() && !view.is_boolean()) return false;
+            value = view.get_value<T>();
+            return true;
+        }
+
+        static bool read(const pson_view& view, char& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, signed char& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, unsigned char& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, short& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, unsigned short& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, int& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, unsigned int& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, long& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, unsigned long& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, long long& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, unsigned long long& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, float& value){ return read_number(view, value); }
+        static bool read(const pson_view& view, double& value){ return read_number(view, value); }
+
+    private:
+        const char* name_;
+        size_t name_size_;
+        pson_view value_;
+        bool matched_;
+    };
+
+    /**
+     * Write a struct with a pson_schema as an object
+     */
+    template<class T>
+    bool encode_struct(pson_writer& writer, T& value){
+        pson_schema_writer schema_writer(writer);
+        schema_writer.write(value);
+        return writer.good();
+    }
+
+    /**
+     * Read the object members into the struct fields with the same name. Missing fields are left unchanged
+     */
+    template<class T>
+    bool decode_struct(const pson_view& view, T& value){
+        return pson_schema_reader::read(view, value);
+    }
 }
 
 #endif
\ No newline at end of file
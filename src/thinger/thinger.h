@@ -32,9 +32,88 @@
 #include "thinger_decoder.hpp"
 #include "thinger_message.hpp"
 #include "thinger_io.hpp"
+#include "thinger_stream_allocator.hpp"
+#include "thinger_outbound_queue.hpp"
 
 #define KEEP_ALIVE_MILLIS 60000
 
+// maximum number of inbound messages processed in a single handle() call
+#ifndef THINGER_HANDLE_MAX_MESSAGES
+    #define THINGER_HANDLE_MAX_MESSAGES 16
+#endif
+
+// maximum time in milliseconds spent processing inbound messages in a single handle() call
+#ifndef THINGER_HANDLE_MAX_MILLIS
+    #define THINGER_HANDLE_MAX_MILLIS 50
+#endif
+
+// maximum number of asynchronous requests waiting for a server response
+#ifndef THINGER_MAX_PENDING_REQUESTS
+    #if defined(__AVR__)
+        #define THINGER_MAX_PENDING_REQUESTS 2
+    #else
+        #define THINGER_MAX_PENDING_REQUESTS 8
+    #endif
+#endif
+
+// default time in milliseconds to wait for the response of an asynchronous request
+#ifndef THINGER_REQUEST_TIMEOUT
+    #define THINGER_REQUEST_TIMEOUT 10000
+#endif
+
+// time in milliseconds that streams and bucket writes can wait in the bulk queue, so they are sent together
+// in a single write. Set to 0 to send every message as soon as it is written
+#ifndef THINGER_BATCH_WINDOW
+    #define THINGER_BATCH_WINDOW 0
+#endif
+
+// queued bulk bytes that trigger a write before the batch window expires, and maximum bytes of bulk frames
+// written in a single handle() call
+#ifndef THINGER_BATCH_MAX_BYTES
+    #if defined(__AVR__)
+        #define THINGER_BATCH_MAX_BYTES 64
+    #else
+        #define THINGER_BATCH_MAX_BYTES 512
+    #endif
+#endif
+
+// maximum bytes of bulk frames waiting to be written. Once full, chunks of the queued frames are written to make room
+#ifndef THINGER_BULK_QUEUE_SIZE
+    #if defined(__AVR__)
+        #define THINGER_BULK_QUEUE_SIZE 128
+    #else
+        #define THINGER_BULK_QUEUE_SIZE 2048
+    #endif
+#endif
+
+// memory (bytes) kept by the frame encoder for the next messages. Larger buffers, grown by large messages, are
+// released once the message is written
+#ifndef THINGER_FRAME_BUFFER_KEEP_SIZE
+    #if defined(__AVR__)
+        #define THINGER_FRAME_BUFFER_KEEP_SIZE 64
+    #else
+        #define THINGER_FRAME_BUFFER_KEEP_SIZE 512
+    #endif
+#endif
+
+// release the frame buffers kept for the next messages after this time (milliseconds) without inbound or outbound
+// messages. Set to 0 to never release them
+#ifndef THINGER_FRAME_BUFFER_IDLE_RELEASE
+    #define THINGER_FRAME_BUFFER_IDLE_RELEASE 30000
+#endif
+
+// define to a size greater than 0 to encode outbound frames in a static buffer of that size instead of allocating
+// it in the heap. Larger messages are streamed to the connection
+#ifndef THINGER_FRAME_BUFFER_STATIC_SIZE
+    #define THINGER_FRAME_BUFFER_STATIC_SIZE 0
+#endif
+
+// define to a size greater than 0 to receive inbound frames in a static buffer of that size instead of allocating
+// it in the heap. Larger frames are decoded from the connection
+#ifndef THINGER_INPUT_FRAME_STATIC_SIZE
+    #define THINGER_INPUT_FRAME_STATIC_SIZE 0
+#endif
+
 #ifdef THINGER_MULTITASK
     #define th_synchronized(code)  \
         lock();                 \
@@ -49,14 +128,39 @@ namespace thinger{
 
     using namespace protoson;
 
-    class thinger : public thinger_io{
+    /**
+     * Completion of an asynchronous request, with the response payload. It is not successful if the server
+     * returned an error, the request timed out, or the connection was lost.
+     */
+#ifdef THINGER_USE_FUNCTIONAL
+    typedef std::function<void(bool success, pson& response)> thinger_response_callback;
+#else
+    typedef void (*thinger_response_callback)(bool success, pson& response);
+#endif
+
+    class thinger : public thinger_io, public thinger_listener_resolver{
     public:
         thinger() :
                 encoder(*this),
-                decoder(*this),
+                decoder(*this, this),
                 last_keep_alive(0),
-                keep_alive_response(true)
+                keep_alive_response(true),
+                handle_max_messages(THINGER_HANDLE_MAX_MESSAGES),
+                handle_max_millis(THINGER_HANDLE_MAX_MILLIS),
+                last_handle_time(0),
+                batch_window(THINGER_BATCH_WINDOW),
+                batch_max_bytes(THINGER_BATCH_MAX_BYTES),
+                batch_start(0),
+                frame_last_use(0),
+                bulk_queue(THINGER_BULK_QUEUE_SIZE),
+                pending_requests()
         {
+#if !defined(THINGER_DISABLE_SINGLE_PASS_ENCODER) && THINGER_FRAME_BUFFER_STATIC_SIZE > 0
+            frame_encoder.get_buffer().assign(frame_encoder_storage, THINGER_FRAME_BUFFER_STATIC_SIZE);
+#endif
+#if THINGER_INPUT_FRAME_STATIC_SIZE > 0
+            frame_reader.set_payload_storage(frame_reader_storage, THINGER_INPUT_FRAME_STATIC_SIZE);
+#endif
 #ifdef THINGER_FREE_RTOS_MULTITASK
             semaphore_ = xSemaphoreCreateMutex();
 #endif
@@ -69,10 +173,43 @@ namespace thinger{
     private:
         thinger_write_encoder encoder;
         thinger_read_decoder decoder;
+        thinger_frame_reader frame_reader;
+#ifndef THINGER_DISABLE_SINGLE_PASS_ENCODER
+        thinger_buffer_encoder frame_encoder;
+    #if THINGER_FRAME_BUFFER_STATIC_SIZE > 0
+        uint8_t frame_encoder_storage[THINGER_FRAME_BUFFER_STATIC_SIZE];
+    #endif
+#endif
+#if THINGER_INPUT_FRAME_STATIC_SIZE > 0
+        uint8_t frame_reader_storage[THINGER_INPUT_FRAME_STATIC_SIZE];
+#endif
         unsigned long last_keep_alive;
         bool keep_alive_response;
+        uint16_t handle_max_messages;
+        unsigned long handle_max_millis;
+        unsigned long last_handle_time;
+        unsigned long batch_window;
+        size_t batch_max_bytes;
+        unsigned long batch_start;
+        // last time, as provided to handle(), that a message was encoded or received
+        unsigned long frame_last_use;
+        thinger_outbound_queue bulk_queue;
         thinger_map<thinger_resource> resources_;
 
+        // asynchronous request waiting for its response, identified by its stream id (0 if the slot is free)
+        struct pending_request{
+            uint16_t stream_id;
+            // the timeout starts on the first handle() after sending the request, with the clock provided to it
+            bool started;
+            unsigned long start;
+            unsigned long timeout;
+            thinger_response_callback callback;
+        };
+
+        pending_request pending_requests[THINGER_MAX_PENDING_REQUESTS];
+        // stream ids of the requests in flight: the pending ones, plus one synchronous request
+        thinger_stream_allocator<THINGER_MAX_PENDING_REQUESTS+1> stream_ids;
+
 #if defined(THINGER_FREE_RTOS_MULTITASK)
         SemaphoreHandle_t semaphore_;
 #elif defined(THINGER_MBED_MULTITASK)
@@ -81,23 +218,39 @@ namespace thinger{
 
     protected:
 
+        /**
+         * Can be override to provide a clock for limiting the time spent in handle(). Without a clock, the
+         * inbound messages are limited only by the message budget.
+         * @return current time in milliseconds
+         */
+        virtual unsigned long get_millis(){
+            return 0;
+        }
+
         /**
          * Can be override to start reconnection process
          */
         virtual void disconnected(){
+            // discard any partially received frame
+            frame_reader.reset();
+            // queued messages are lost with the connection
+            bulk_queue.clear();
+            // the responses of the pending requests will not arrive
+            fail_pending_requests();
             // stop all streaming resources after disconnect
             stop_streams();
         }
 
         bool connect(const char* username, const char* device_id, const char* credential){
-            // reset keep alive status for each connection
+            // reset keep alive status and input state for each connection
             keep_alive_response = true;
+            frame_reader.reset();
             thinger_message message;
             message.set_signal_flag(thinger_message::AUTH);
             message.resources().add(username).add(device_id).add(credential);
 
             /** temporal fix for old production server **/
-            if(!send_message(message)) return false;
+            if(!send_message(message, CONTROL_PRIORITY)) return false;
             thinger_message response;
             return read_message(response) && response.get_signal_flag() == thinger_message::REQUEST_OK;
 
@@ -159,6 +312,17 @@ namespace thinger{
             return send_message(request, data);
         }
 
+        /**
+         * Read a property stored in the server
+         * @param property_identifier property identifier
+         * @return property data received from server, or an empty value if the property could not be read
+         */
+        pson get_property(const char* property_identifier){
+            pson data;
+            get_property(property_identifier, data);
+            return data;
+        }
+
         /**
          * Set a property in the server
          * @param property_identifier property identifier
@@ -174,6 +338,17 @@ namespace thinger{
             return send_message_with_ack(message, confirm_write);
         }
 
+        /**
+         * Set a property in the server, taking the ownership of the data
+         */
+        bool set_property(const char* property_identifier, pson&& data, bool confirm_write=false){
+            thinger_message message;
+            message.set_signal_flag(thinger_message::SET_PROPERTY);
+            message.set_identifier(property_identifier);
+            message.set_data(static_cast<pson&&>(data));
+            return send_message_with_ack(message, confirm_write);
+        }
+
         /**
          * Execute a resource in a remote device (without data)
          * @param device_name remote device identifier (must be connected to your account)
@@ -216,7 +391,7 @@ namespace thinger{
             message.set_signal_flag(thinger_message::CALL_DEVICE);
             message.set_identifier(device_name);
             message.resources().add(resource_name);
-            resource.fill_output(message.get_data());
+            resource.fill_output(message);
             return send_message_with_ack(message, confirm_call);
         }
 
@@ -246,6 +421,17 @@ namespace thinger{
             return send_message_with_ack(message, confirm_call);
         }
 
+        /**
+         * Call a server endpoint, taking the ownership of the data
+         */
+        bool call_endpoint(const char* endpoint_name, pson&& data, bool confirm_call=false){
+            thinger_message message;
+            message.set_signal_flag(thinger_message::CALL_ENDPOINT);
+            message.set_identifier(endpoint_name);
+            message.set_data(static_cast<pson&&>(data));
+            return send_message_with_ack(message, confirm_call);
+        }
+
         /**
          * Call a server endpoint
          * @param endpoint_name endpoint identifier, as defined in the server
@@ -256,7 +442,7 @@ namespace thinger{
             thinger_message message;
             message.set_signal_flag(thinger_message::CALL_ENDPOINT);
             message.set_identifier(endpoint_name);
-            resource.fill_output(message.get_data());
+            resource.fill_output(message);
             return send_message_with_ack(message, confirm_call);
         }
 
@@ -281,7 +467,18 @@ namespace thinger{
             message.set_signal_flag(thinger_message::BUCKET_DATA);
             message.set_identifier(bucket_id);
             message.set_data(data);
-            return send_message_with_ack(message, confirm_write);
+            return confirm_write ? send_message_with_ack(message) : queue_message(message);
+        }
+
+        /**
+         * Write arbitrary data to a given bucket identifier, taking the ownership of the data
+         */
+        bool write_bucket(const char* bucket_id, pson&& data, bool confirm_write=false){
+            thinger_message message;
+            message.set_signal_flag(thinger_message::BUCKET_DATA);
+            message.set_identifier(bucket_id);
+            message.set_data(static_cast<pson&&>(data));
+            return confirm_write ? send_message_with_ack(message) : queue_message(message);
         }
 
         /**
@@ -294,8 +491,8 @@ namespace thinger{
             thinger_message message;
             message.set_signal_flag(thinger_message::BUCKET_DATA);
             message.set_identifier(bucket_id);
-            resource.fill_output(message.get_data());
-            return send_message_with_ack(message, confirm_write);
+            resource.fill_output(message);
+            return confirm_write ? send_message_with_ack(message) : queue_message(message);
         }
 
         /**
@@ -308,18 +505,99 @@ namespace thinger{
             return write_bucket(bucket_id, resources_[resource_name], confirm_write);
         }
 
+        /**
+         * Send a message without waiting for its response. The callback is called from handle() once the
+         * response arrives, or the request times out.
+         * @param message message to be sent
+         * @param callback function called with the request result and the response payload
+         * @param timeout time in milliseconds to wait for the response
+         * @return true if the message was sent, false if it could not be written, or there are already
+         * THINGER_MAX_PENDING_REQUESTS requests waiting for a response
+         */
+        bool send_message_async(thinger_message& message, thinger_response_callback callback, unsigned long timeout=THINGER_REQUEST_TIMEOUT){
+            bool result = false;
+            th_synchronized(
+                pending_request* pending = reserve_pending_request(message);
+                if(pending!=NULL){
+                    pending->callback = callback;
+                    pending->timeout = timeout;
+                    result = write_message(message);
+                    if(!result) release_pending_request(*pending);
+                }
+            )
+            return result;
+        }
+
+        /**
+         * Read a property stored in the server without blocking
+         * @param property_identifier property identifier
+         * @param callback function called with the property data received from server
+         */
+        bool get_property_async(const char* property_identifier, thinger_response_callback callback, unsigned long timeout=THINGER_REQUEST_TIMEOUT){
+            thinger_message request;
+            request.set_signal_flag(thinger_message::GET_PROPERTY);
+            request.set_identifier(property_identifier);
+            return send_message_async(request, callback, timeout);
+        }
+
+        /**
+         * Call a server endpoint without blocking
+         * @param endpoint_name endpoint identifier, as defined in the server
+         * @param callback function called once the server confirms the call
+         */
+        bool call_endpoint_async(const char* endpoint_name, thinger_response_callback callback, unsigned long timeout=THINGER_REQUEST_TIMEOUT){
+            thinger_message message;
+            message.set_signal_flag(thinger_message::CALL_ENDPOINT);
+            message.set_identifier(endpoint_name);
+            return send_message_async(message, callback, timeout);
+        }
+
+        /**
+         * Call a server endpoint with data, without blocking
+         * @param endpoint_name endpoint identifier, as defined in the server
+         * @param data data in pson format to be used as data source for the endpoint call
+         * @param callback function called once the server confirms the call
+         */
+        bool call_endpoint_async(const char* endpoint_name, pson& data, thinger_response_callback callback, unsigned long timeout=THINGER_REQUEST_TIMEOUT){
+            thinger_message message;
+            message.set_signal_flag(thinger_message::CALL_ENDPOINT);
+            message.set_identifier(endpoint_name);
+            message.set_data(data);
+            return send_message_async(message, callback, timeout);
+        }
+
+        /**
+         * Write data to a given bucket identifier, without blocking
+         * @param bucket_id bucket identifier
+         * @param data data to write defined in a pson structure
+         * @param callback function called once the server confirms the write
+         */
+        bool write_bucket_async(const char* bucket_id, pson& data, thinger_response_callback callback, unsigned long timeout=THINGER_REQUEST_TIMEOUT){
+            thinger_message message;
+            message.set_signal_flag(thinger_message::BUCKET_DATA);
+            message.set_identifier(bucket_id);
+            message.set_data(data);
+            return send_message_async(message, callback, timeout);
+        }
+
         /**
          * Stream the given resource
          * @param resource resource defined in the code, i.e, thing["location"]
          * @param type STREAM_EVENT or STREAM_SAMPLE, depending if the stream was an event or a scheduled sampling
          */
         void stream_resource(thinger_resource& resource, thinger_message::signal_flag type){
+            memory_scope scope;
             thinger_message message;
             message.set_stream_id(resource.get_stream_id());
             message.set_signal_flag(type);
             // TODO modify and update servers to support resource.fill_output(message.get_data());
-            resource.fill_api_io(message.get_data());
-            send_message(message);
+            thinger_resource::api_output_writer output(resource);
+            if(resource.has_output_writer()){
+                message.set_data_writer(&output);
+            }else{
+                resource.fill_api_io(message.get_data());
+            }
+            queue_message(message);
         }
 
         /**
@@ -332,12 +610,19 @@ namespace thinger{
                 thinger_message message;
                 message.set_stream_id(resource.get_stream_id());
                 message.set_signal_flag(thinger_message::STREAM_EVENT);
-                pson::swap(payload, message.get_data());
-                return send_message(message);
+                message.get_data() = static_cast<pson&&>(payload);
+                return queue_message(message);
             }
             return false;
         }
 
+        /**
+         * Stream the given resource with given data, taking the ownership of the data
+         */
+        bool stream_data(thinger_resource& resource, pson&& payload){
+            return stream_data(resource, payload);
+        }
+
          /**
           * Stream the given resource. There should be any process listening for such resource, i.e., over a server websocket.
           * @param resource resource defined in the code, i.e, thing["location"]
@@ -360,19 +645,100 @@ namespace thinger{
             return stream(resources_[resource]);
         }
 
+        /**
+         * Set the limits for processing inbound messages in a single handle() call. Messages are processed while
+         * there is input available and none of the limits has been reached.
+         * @param max_messages maximum number of messages handled per call (at least one is always handled)
+         * @param max_millis maximum time spent handling messages, as measured by get_millis()
+         */
+        void set_handle_budget(uint16_t max_messages, unsigned long max_millis=THINGER_HANDLE_MAX_MILLIS){
+            handle_max_messages = max_messages;
+            handle_max_millis = max_millis;
+        }
+
+        /**
+         * Set how long streams and bucket writes can wait to be sent together with other messages. Responses
+         * and requests waiting for a response are always sent right away, ahead of the waiting messages.
+         * @param window_millis maximum time a message waits in the batch, as measured by the clock provided to
+         * handle(). Set to 0 to disable batching
+         * @param max_bytes queued bytes that trigger a write before the window expires, and maximum bytes
+         * written on each handle() call
+         */
+        void set_batch_window(unsigned long window_millis, size_t max_bytes=THINGER_BATCH_MAX_BYTES){
+            batch_window = window_millis;
+            batch_max_bytes = max_bytes;
+        }
+
+        /**
+         * Set the maximum bytes of streams and bucket writes waiting to be written. Once the queue is full,
+         * chunks of the queued messages are written to make room for the new ones.
+         */
+        void set_bulk_queue_size(size_t size){
+            bulk_queue.set_limit(size);
+        }
+
+        /**
+         * Set the maximum size of the inbound frames received in memory, THINGER_MAX_BUFFERED_FRAME by default.
+         * These frames are received along several handle() calls without blocking. Larger frames are decoded
+         * from the connection as they arrive, so handle() blocks until the whole frame is received or the read
+         * times out. With THINGER_INPUT_FRAME_STATIC_SIZE, frames are also limited to the static buffer.
+         */
+        void set_max_buffered_frame(uint32_t size){
+            frame_reader.set_max_buffered(size);
+        }
+
+        /**
+         * @return number of requests sent to the server that are still waiting for a response
+         */
+        uint16_t get_requests_in_flight() const{
+            return stream_ids.in_flight();
+        }
+
         /**
          * This method should be called periodically, indicating the current timestamp, and if there are bytes
          * available in the connection
          * @param current_time in milliseconds, i.e., unix epoch or millis from start.
          * @param bytes_available true or false indicating if there is input data available for reading.
+         * @return number of inbound messages handled, including keep alives
          */
-        void handle(unsigned long current_time, bool bytes_available)
+        size_t handle(unsigned long current_time, bool bytes_available)
         {
-            // handle input
+            size_t handled = 0;
+            last_handle_time = current_time;
+            if(bytes_available) frame_last_use = current_time;
+
+            // handle input, draining the available messages up to the configured budget
             if(bytes_available){
-                thinger_message message;
-                th_synchronized(bool result = read_message(message)==MESSAGE;)
-                if(result) handle_request_received(message);
+                unsigned long start = get_millis();
+                do{
+                    // request and response nodes share the same memory scope
+                    memory_scope scope;
+                    // the frame is detached from the reader while the message is handled, as the message payload
+                    // may reference it, and other reads (nested requests or other tasks) would overwrite it
+                    pson_buffer frame;
+                    thinger_message message;
+                    // read only the available bytes, the message is handled once the whole frame has been received
+                    // responses to pending requests are matched while reading, as the table is shared with senders
+                    bool response = false;
+                    thinger_response_callback callback = thinger_response_callback();
+                    th_synchronized(
+                        message_type type = read_message(message, false);
+                        if(type==MESSAGE){
+                            frame_reader.detach_payload(frame);
+                            response = take_pending_response(message, callback);
+                        }
+                    )
+                    // no complete frame available
+                    if(type==NONE) break;
+                    if(type==MESSAGE){
+                        handle_message_received(message, response, callback);
+                        th_synchronized(frame_reader.reuse_payload(frame);)
+                    }
+                    // keep alive frames are drained too, counting against the budget
+                    ++handled;
+                    if(handled>=handle_max_messages || get_millis()-start>=handle_max_millis) break;
+                    th_synchronized(bytes_available = input_available()>0;)
+                }while(bytes_available);
             }
 
             // handle keep alive (send keep alive to server to prevent disconnection)
@@ -380,9 +746,13 @@ namespace thinger{
                 if(keep_alive_response){
                     last_keep_alive = current_time;
                     keep_alive_response = false;
-                    if(!send_keep_alive()) return disconnected();
+                    if(!send_keep_alive()){
+                        disconnected();
+                        return handled;
+                    }
                 }else{
-                    return disconnected();
+                    disconnected();
+                    return handled;
                 }
             }
 
@@ -390,6 +760,27 @@ namespace thinger{
             if(thinger_resource::get_streaming_counter()>0){
                 handle_streaming(resources_, current_time);
             }
+
+            // fail the requests whose response did not arrive in time
+            expire_pending_requests(current_time);
+
+            // write the queued bulk frames once they are due, a chunk per call, so the requests received in
+            // the meantime are answered before the rest of the queue
+            if(!bulk_queue.empty() && (bulk_queue.size()>=batch_max_bytes || current_time-batch_start>=batch_window)){
+                th_synchronized(write_bulk(batch_max_bytes);)
+            }
+
+#if THINGER_FRAME_BUFFER_IDLE_RELEASE > 0
+            // free the memory kept for the next frames after a while without traffic
+            th_synchronized(
+                if(current_time-frame_last_use>=THINGER_FRAME_BUFFER_IDLE_RELEASE){
+                    frame_last_use = current_time;
+                    release_frame_buffers();
+                }
+            )
+#endif
+
+            return handled;
         }
 
     private:
@@ -417,26 +808,36 @@ namespace thinger{
         /**
          * Decode a message from the current connection. It should be called when there are bytes available for reading.
          * @param message reference to the message that will be filled with the decoded information
+         * @param blocking wait for the whole message, or just consume the available bytes and return NONE if the
+         * message is not complete yet (it will be resumed in the next call)
          * @return true or false if the message passed in reference was filled with a valid message.
          */
-        message_type read_message(thinger_message& message){
-            uint32_t type = 0;
-            if(decoder.pb_decode_varint32(type)){
-                switch(type){
-                    case MESSAGE: {
-                        // decode message size & message itself
-                        uint32_t size = 0;
-                        return decoder.pb_decode_varint32(size) && decoder.decode(message, size) ? MESSAGE : NONE;
-                    }
-                    case KEEP_ALIVE: {
-                        // update our keep_alive flag (connection active)
-                        keep_alive_response = true;
-                        // skip size bytes in keep alive (always 0)
-                        return decoder.pb_skip_varint() ? KEEP_ALIVE : NONE;
+        message_type read_message(thinger_message& message, bool blocking=true){
+            if(!frame_reader.read(*this, blocking)) return NONE;
+            message_type type = NONE;
+            uint32_t size = frame_reader.get_size();
+            switch(frame_reader.get_type()){
+                case MESSAGE:
+                    if(frame_reader.buffered()){
+                        thinger_memory_decoder memory_decoder(frame_reader.get_payload(), size);
+                        type = memory_decoder.decode(message, size) ? MESSAGE : NONE;
+                    }else{
+                        // large message, decode it directly from the socket
+                        type = decoder.decode(message, size) ? MESSAGE : NONE;
                     }
-                }
+                    break;
+                case KEEP_ALIVE:
+                    // update our keep_alive flag (connection active)
+                    keep_alive_response = true;
+                    type = frame_reader.buffered() || decoder.pb_skip(size) ? KEEP_ALIVE : NONE;
+                    break;
+                default:
+                    // skip unknown frames
+                    if(!frame_reader.buffered()) decoder.pb_skip(size);
+                    break;
             }
-            return NONE;
+            // the frame is kept until the next read, as the message payload may be a view over it
+            return type;
         }
 
         /**
@@ -455,10 +856,18 @@ namespace thinger{
                     case MESSAGE:
                         if(request.get_stream_id() == response.get_stream_id()){
                             // copy response payload to provided structure
-                            if(payload != NULL && response.has_data()) pson::swap(response.get_data(), *payload);
+                            if(payload != NULL && response.has_data()) *payload = static_cast<pson&&>(response.get_data());
                             return response.get_signal_flag()==thinger_message::REQUEST_OK;
                         }
-                        handle_request_received(response);
+                        // keep the frame while the message is handled, as it may send its own requests
+                        {
+                            pson_buffer frame;
+                            frame_reader.detach_payload(frame);
+                            thinger_response_callback callback = thinger_response_callback();
+                            bool pending = take_pending_response(response, callback);
+                            handle_message_received(response, pending, callback);
+                            frame_reader.reuse_payload(frame);
+                        }
                         break;
                         // keep alive is handled inside read_message automatically
                     case KEEP_ALIVE:
@@ -473,27 +882,110 @@ namespace thinger{
         /**
          * Write a message to the socket
          * @param message
+         * @param priority bulk messages wait in the bulk queue while batching or while there are other bulk
+         * messages queued, the rest are written right away
          * @return true if success
          */
-        bool write_message(thinger_message& message){
-            thinger_encoder sink;
-            sink.encode(message);
+        bool write_message(thinger_message& message, outbound_priority priority=INTERACTIVE_PRIORITY){
+            bool queue = priority==BULK_PRIORITY && (batch_window>0 || !bulk_queue.empty());
+#ifndef THINGER_DISABLE_SINGLE_PASS_ENCODER
+            frame_last_use = last_handle_time;
+            frame_encoder.reset();
+            if(frame_encoder.encode_frame(message)){
+                pson_buffer& frame = frame_encoder.get_buffer();
+                bool result = queue ? queue_frame(frame.data(), frame.size()) : write((const char*)frame.data(), frame.size(), true);
+                trim_frame_buffer();
+                return result;
+            }
+            trim_frame_buffer();
+            // not enough memory for the whole frame, or its payload writer failed, so stream it to the socket
+#endif
+            // bulk messages that cannot be queued are streamed after the whole queue, in chunks as in handle(), so
+            // they keep the send order
+            if(queue && !write_bulk_queue()) return false;
             encoder.pb_encode_varint(MESSAGE);
-            encoder.pb_encode_varint(sink.bytes_written());
+            encoder.pb_encode_varint(thinger_encoder::size(message));
             encoder.encode(message);
             return write(NULL, 0, true);
         }
 
+        /**
+         * Free the heap memory kept by the frame encoder and the frame reader. Static buffers are kept
+         */
+        void release_frame_buffers(){
+#ifndef THINGER_DISABLE_SINGLE_PASS_ENCODER
+            frame_encoder.get_buffer().release();
+#endif
+            frame_reader.release_payload();
+        }
+
+#ifndef THINGER_DISABLE_SINGLE_PASS_ENCODER
+        /**
+         * Release the frame encoder memory grown over THINGER_FRAME_BUFFER_KEEP_SIZE by a large message
+         */
+        void trim_frame_buffer(){
+            pson_buffer& buffer = frame_encoder.get_buffer();
+            if(buffer.capacity()>THINGER_FRAME_BUFFER_KEEP_SIZE) buffer.release();
+        }
+#endif
+
+        /**
+         * Add a bulk frame to the queue. If it is full, chunks of the queued frames are written, as in handle(),
+         * until the frame fits
+         */
+        bool queue_frame(const uint8_t* frame, size_t size){
+            while(!bulk_queue.empty()){
+                if(bulk_queue.push(frame, size)) return true;
+                if(!write_bulk(batch_max_bytes)) return false;
+            }
+            batch_start = last_handle_time;
+            // frames larger than the queue are written directly
+            return bulk_queue.push(frame, size) || write((const char*)frame, size, true);
+        }
+
+        /**
+         * Write the frames at the head of the bulk queue in a single write
+         * @param max maximum bytes to write, although the first frame is always written
+         */
+        bool write_bulk(size_t max){
+            const uint8_t* data;
+            size_t size = bulk_queue.front(max, data);
+            if(size==0) return true;
+            bool result = write((const char*)data, size, true);
+            bulk_queue.pop(size);
+            return result;
+        }
+
+        /**
+         * Write all the queued bulk frames, in chunks of batch_max_bytes
+         */
+        bool write_bulk_queue(){
+            while(!bulk_queue.empty()){
+                if(!write_bulk(batch_max_bytes)) return false;
+            }
+            return true;
+        }
+
         /**
          * Send a message
          * @param message message to be sent
+         * @param priority outbound class of the message
          * @return true if the message was written to the socket
          */
-        bool send_message(thinger_message& message){
-            th_synchronized(bool result = write_message(message);)
+        bool send_message(thinger_message& message, outbound_priority priority=INTERACTIVE_PRIORITY){
+            th_synchronized(bool result = write_message(message, priority);)
             return result;
         }
 
+        /**
+         * Send a message that can wait for the batch window, so it is written along with other messages
+         * @param message message to be sent
+         * @return true if the message was queued or written to the socket
+         */
+        bool queue_message(thinger_message& message){
+            return send_message(message, BULK_PRIORITY);
+        }
+
         /**
          * Send a message and optionally wait for server acknowledgement
          * @param message message to be sent
@@ -501,9 +993,8 @@ namespace thinger{
          * @return true if the message was acknowledged by the server.
          */
         bool send_message_with_ack(thinger_message& message, bool wait_ack=true){
-            if(wait_ack) message.set_random_stream_id();
-            th_synchronized(bool result = write_message(message) && (!wait_ack || wait_response(message));)
-            return result;
+            if(!wait_ack) return send_message(message);
+            return send_request(message, NULL);
         }
 
         /**
@@ -513,7 +1004,25 @@ namespace thinger{
          * @return true if the message was acknowledged by the server.
          */
         bool send_message(thinger_message& message, protoson::pson& data){
-            th_synchronized(bool result = write_message(message) && wait_response(message, &data););
+            return send_request(message, &data);
+        }
+
+        /**
+         * Send a message with its own stream id, and wait for the response
+         * @param message message to be sent
+         * @param payload optional structure to be filled with the response payload
+         * @return true if the message was acknowledged by the server.
+         */
+        bool send_request(thinger_message& message, protoson::pson* payload){
+            bool result = false;
+            th_synchronized(
+                uint16_t stream_id = stream_ids.allocate();
+                if(stream_id!=0){
+                    message.set_stream_id(stream_id);
+                    result = write_message(message) && wait_response(message, payload);
+                    stream_ids.release(stream_id);
+                }
+            )
             return result;
         }
 
@@ -531,6 +1040,130 @@ namespace thinger{
             return result;
         }
 
+        /**
+         * Take a free slot in the pending requests table, assigning the message a stream id not used by any
+         * other request in flight
+         * @return the reserved slot, or NULL if the table is full
+         */
+        pending_request* reserve_pending_request(thinger_message& message){
+            pending_request* free_slot = NULL;
+            for(size_t i=0; i<THINGER_MAX_PENDING_REQUESTS && free_slot==NULL; i++){
+                if(pending_requests[i].stream_id==0) free_slot = &pending_requests[i];
+            }
+            if(free_slot==NULL) return NULL;
+            uint16_t stream_id = stream_ids.allocate();
+            if(stream_id==0) return NULL;
+            message.set_stream_id(stream_id);
+            free_slot->stream_id = stream_id;
+            free_slot->started = false;
+            return free_slot;
+        }
+
+        void release_pending_request(pending_request& pending){
+            stream_ids.release(pending.stream_id);
+            pending.stream_id = 0;
+            pending.callback = thinger_response_callback();
+        }
+
+        /**
+         * Release a pending request, taking its callback. The lock must be held, and the callback is called
+         * afterwards without it, so it can send new requests.
+         */
+        void take_pending_request(pending_request& pending, thinger_response_callback& callback){
+            callback = static_cast<thinger_response_callback&&>(pending.callback);
+            release_pending_request(pending);
+        }
+
+        /**
+         * Take the callback of the pending request answered by the message. The lock must be held.
+         * @return true if the message is the response of a pending request
+         */
+        bool take_pending_response(thinger_message& message, thinger_response_callback& callback){
+            thinger_message::signal_flag flag = message.get_signal_flag();
+            if(message.get_stream_id()==0 || (flag!=thinger_message::REQUEST_OK && flag!=thinger_message::REQUEST_ERROR)) return false;
+            for(size_t i=0; i<THINGER_MAX_PENDING_REQUESTS; i++){
+                if(pending_requests[i].stream_id==message.get_stream_id()){
+                    take_pending_request(pending_requests[i], callback);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Start the timeout of the requests sent since the last call, and fail the ones that expired
+         */
+        void expire_pending_requests(unsigned long current_time){
+            for(size_t i=0; i<THINGER_MAX_PENDING_REQUESTS; i++){
+                bool expired = false;
+                thinger_response_callback callback = thinger_response_callback();
+                th_synchronized(
+                    pending_request& pending = pending_requests[i];
+                    if(pending.stream_id!=0 && !pending.started){
+                        pending.started = true;
+                        pending.start = current_time;
+                    }
+                    if(pending.stream_id!=0 && current_time-pending.start>=pending.timeout){
+                        take_pending_request(pending, callback);
+                        expired = true;
+                    }
+                )
+                if(expired && callback){
+                    pson empty;
+                    callback(false, empty);
+                }
+            }
+        }
+
+        /**
+         * Expire all the pending requests, so they fail on the next handle(). This may be called with or
+         * without the lock held, so the callbacks are not called here.
+         */
+        void fail_pending_requests(){
+            for(size_t i=0; i<THINGER_MAX_PENDING_REQUESTS; i++){
+                pending_requests[i].started = true;
+                pending_requests[i].timeout = 0;
+            }
+        }
+
+        /**
+         * Handle a received message: a response completes its pending request, and any other message is
+         * handled as a request from the server
+         * @param response true if the message answers a pending request
+         * @param callback callback of the answered request
+         */
+        void handle_message_received(thinger_message& message, bool response, thinger_response_callback& callback){
+            if(!response){
+                handle_request_received(message);
+            }else if(callback){
+                callback(message.get_signal_flag()==thinger_message::REQUEST_OK, message.get_data());
+            }
+        }
+
+        /**
+         * Find the resource addressed by a request, i.e., temperature/degrees
+         * @return the resource, or NULL if it does not exist
+         */
+        thinger_resource* find_resource(thinger_message& request){
+            thinger_resource* resource = NULL;
+            for(pson_array::iterator it = request.resources().begin(); it.valid(); it.next()){
+                if(!it.item().is_string()) return NULL;
+                const char* name = it.item();
+                resource = resource == NULL ? resources_.find(name) : resource->find(name);
+                if(resource==NULL) return NULL;
+            }
+            return resource;
+        }
+
+        /**
+         * Requests to a resource with an input listener stream their payload to the listener while decoding
+         */
+        virtual pson_listener* get_payload_listener(thinger_message& request){
+            if(request.get_signal_flag()!=thinger_message::NONE || !request.has_resource()) return NULL;
+            thinger_resource* resource = find_resource(request);
+            return resource!=NULL ? resource->get_input_listener() : NULL;
+        }
+
         /**
          * Handle an incoming request from the server
          * @param request the message sent by the server
@@ -586,7 +1219,7 @@ namespace thinger{
                             if(thing_resource==NULL){
                                 thinger_map<thinger_resource>::entry* current = resources_.begin();
                                 while(current!=NULL){
-                                    current->value_.fill_api(response.get_data()[current->key_]);
+                                    current->value_.fill_api(response.get_data().borrow(current->key_));
                                     current = current->next_;
                                 }
                             // fll the api over the specified resource
@@ -605,7 +1238,7 @@ namespace thinger{
                             }else{
                                 thing_resource->handle_request(request, response);
                                 // stream enabled over a resource input -> notify the current state
-                                if(thing_resource->stream_enabled() && (thing_resource->get_io_type()==thinger_resource::pson_in || thing_resource->get_io_type()==thinger_resource::pson_in_pson_out)){
+                                if(thing_resource->stream_enabled() && thing_resource->has_input()){
                                     // send normal response
                                     if(send_message(response)){
 #ifdef THINGER_USE_FUNCTIONAL
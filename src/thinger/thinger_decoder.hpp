@@ -26,9 +26,29 @@
 
 #include "pson.h"
 #include "thinger_message.hpp"
+#include "thinger_io.hpp"
+
+// frames up to this size are read in the background and decoded from memory. Larger frames, or frames that cannot
+// be allocated, are decoded from the socket as they arrive, blocking handle() until the whole frame is received or
+// the read times out
+#ifndef THINGER_MAX_BUFFERED_FRAME
+    #if defined(__AVR__)
+        #define THINGER_MAX_BUFFERED_FRAME 256
+    #else
+        #define THINGER_MAX_BUFFERED_FRAME 1024
+    #endif
+#endif
 
 namespace thinger{
 
+    /**
+     * Provides the listener that receives the payload of a message while it is decoded, if any.
+     */
+    class thinger_listener_resolver{
+    public:
+        virtual protoson::pson_listener* get_payload_listener(thinger_message& message) = 0;
+    };
+
     class thinger_decoder : public protoson::pson_decoder{
     public:
         bool decode(thinger_message&  message, size_t size){
@@ -74,7 +94,7 @@ namespace thinger{
                                 if(!protoson::pson_decoder::decode(message.get_resources())) return false;
                                 break;
                             case thinger_message::PAYLOAD:
-                                if(!protoson::pson_decoder::decode(((protoson::pson&) message))) return false;
+                                if(!decode_payload(message)) return false;
                                 break;
                             default:
                                 break;
@@ -92,11 +112,16 @@ namespace thinger{
             }
             return true;
         }
+
+    protected:
+        virtual bool decode_payload(thinger_message& message){
+            return protoson::pson_decoder::decode(((protoson::pson&) message));
+        }
     };
 
     class thinger_read_decoder : public thinger_decoder{
     public:
-        thinger_read_decoder(thinger_io& io) : io_(io)
+        thinger_read_decoder(thinger_io& io, thinger_listener_resolver* resolver=NULL) : io_(io), resolver_(resolver)
         {}
 
     protected:
@@ -104,14 +129,26 @@ namespace thinger{
             return io_.read((char*)buffer, size) && protoson::pson_decoder::read(buffer, size);
         }
 
+        /**
+         * Payloads with a listener are streamed to it from the socket, without keeping them in memory
+         */
+        virtual bool decode_payload(thinger_message& message){
+            protoson::pson_listener* listener = resolver_!=NULL ? resolver_->get_payload_listener(message) : NULL;
+            if(listener!=NULL) return protoson::pson_decoder::decode(*listener);
+            return thinger_decoder::decode_payload(message);
+        }
+
     private:
         thinger_io& io_;
+        thinger_listener_resolver* resolver_;
     };
 
     class thinger_memory_decoder : public thinger_decoder{
 
     public:
-        thinger_memory_decoder(uint8_t* buffer, size_t size) : buffer_(buffer), size_(size){}
+        thinger_memory_decoder(uint8_t* buffer, size_t size) : buffer_(buffer), size_(size){
+            set_memory(buffer, size);
+        }
 
     protected:
         virtual bool read(void* buffer, size_t size){
@@ -123,11 +160,191 @@ namespace thinger{
             }
         }
 
+        /**
+         * The payload is not decoded, but referenced in the buffer, so it can be read in place with a pson_view
+         */
+        virtual bool decode_payload(thinger_message& message){
+            protoson::pson_view payload(buffer_ + read_, size_ - read_);
+            size_t size = payload.encoded_size();
+            if(size==0) return false;
+            message.set_data_view(payload);
+            read_ += size;
+            return true;
+        }
+
     private:
         uint8_t* buffer_;
         size_t size_;
     };
 
+    /**
+     * Reads a frame (message type, size, and payload) from the socket. Non-blocking reads consume only the
+     * bytes already available, keeping the state between calls, so a frame can be received along several
+     * calls without waiting for it. Frames larger than the maximum buffered frame are not kept in memory:
+     * the reader stops after the frame header so the payload can be decoded from the socket, blocking until
+     * it is complete, and any payload memory is released. A buffered
+     * payload is kept until the next frame is read, or detached while a message referencing it is handled.
+     * Payloads go to the heap, or to a static storage if one is set.
+     */
+    class thinger_frame_reader{
+    public:
+        thinger_frame_reader() : state_(FRAME_TYPE), type_(0), size_(0), received_(0), shift_(0),
+            max_buffered_(THINGER_MAX_BUFFERED_FRAME), storage_(NULL), storage_size_(0), storage_lent_(false){
+        }
+
+        /**
+         * Set the maximum size of the frames received in memory, THINGER_MAX_BUFFERED_FRAME by default
+         */
+        void set_max_buffered(uint32_t size){
+            max_buffered_ = size;
+        }
+
+        /**
+         * Receive the payloads in the given memory instead of the heap. Larger frames are streamed.
+         */
+        void set_payload_storage(void* storage, size_t size){
+            storage_ = (uint8_t*) storage;
+            storage_size_ = size;
+            payload_.assign(storage, size);
+        }
+
+        // free the payload memory while no frame is being received on it
+        void release_payload(){
+            if(state_!=FRAME_PAYLOAD) payload_.release();
+        }
+
+        /**
+         * Continue reading the current frame
+         * @param io connection to read from
+         * @param blocking true to wait until the frame is available, false to read only the available bytes
+         * @return true if the frame is ready: either its payload is in memory, or it must be streamed.
+         */
+        bool read(thinger_io& io, bool blocking){
+            // the previous frame was already consumed
+            if(state_==FRAME_READY || state_==FRAME_STREAM) reset();
+            while(state_!=FRAME_READY && state_!=FRAME_STREAM){
+                size_t read;
+                if(state_==FRAME_PAYLOAD){
+                    char* buffer = (char*) payload_.data() + received_;
+                    size_t pending = size_ - received_;
+                    read = blocking ? (io.read(buffer, pending) ? pending : 0) : io.read_available(buffer, pending);
+                    received_ += read;
+                    if(received_==size_) state_ = FRAME_READY;
+                }else{
+                    uint8_t byte;
+                    read = blocking ? (io.read((char*)&byte, 1) ? 1 : 0) : io.read_available((char*)&byte, 1);
+                    if(read>0 && !decode_header(byte)){
+                        reset();
+                        return false;
+                    }
+                }
+                if(read==0){
+                    // in blocking mode, the connection failed in the middle of a frame
+                    if(blocking) reset();
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void reset(){
+            state_ = FRAME_TYPE;
+            type_ = 0;
+            size_ = 0;
+            received_ = 0;
+            shift_ = 0;
+            payload_.clear();
+        }
+
+        uint32_t get_type() const{
+            return type_;
+        }
+
+        uint32_t get_size() const{
+            return size_;
+        }
+
+        // true if the frame payload is in memory, false if it must be read from the socket
+        bool buffered() const{
+            return state_==FRAME_READY;
+        }
+
+        uint8_t* get_payload(){
+            return payload_.data();
+        }
+
+        /**
+         * Take the payload of the ready frame, so it outlives the next reads. The reader continues with the
+         * memory previously held in the given buffer.
+         */
+        void detach_payload(protoson::pson_buffer& buffer){
+            buffer.swap(payload_);
+            if(buffer.fixed()) storage_lent_ = true;
+        }
+
+        /**
+         * Give back a detached payload, so its memory is reused for the next frames if the reader has none
+         */
+        void reuse_payload(protoson::pson_buffer& buffer){
+            // the assigned storage is taken back now, or for the next frame if one is being received
+            if(buffer.fixed()) storage_lent_ = false;
+            // not while a payload is being received on it
+            if(state_!=FRAME_PAYLOAD && (buffer.fixed() || (!payload_.fixed() && payload_.capacity()<buffer.capacity()))){
+                buffer.clear();
+                buffer.swap(payload_);
+            }
+        }
+
+    private:
+        enum frame_state{
+            FRAME_TYPE,
+            FRAME_SIZE,
+            FRAME_PAYLOAD,
+            FRAME_READY,
+            FRAME_STREAM
+        };
+
+        bool decode_header(uint8_t byte){
+            uint32_t& value = state_==FRAME_TYPE ? type_ : size_;
+            if(shift_>=32) return false;
+            value |= (uint32_t)(byte & 0x7F) << shift_;
+            shift_ += 7;
+            if(byte>=0x80) return true;
+            shift_ = 0;
+            if(state_==FRAME_TYPE){
+                state_ = FRAME_SIZE;
+            }else if(size_==0){
+                state_ = FRAME_READY;
+            }else{
+                take_storage();
+                if(size_<=max_buffered_ && payload_.resize(size_)){
+                    state_ = FRAME_PAYLOAD;
+                }else{
+                    // too large, or not enough memory: the payload is streamed, and the memory kept is released
+                    state_ = FRAME_STREAM;
+                    payload_.release();
+                }
+            }
+            return true;
+        }
+
+        // back to the assigned storage once it is not lent to a detached payload
+        void take_storage(){
+            if(storage_!=NULL && !storage_lent_ && !payload_.fixed()) payload_.assign(storage_, storage_size_);
+        }
+
+        frame_state state_;
+        uint32_t type_;
+        uint32_t size_;
+        uint32_t received_;
+        uint8_t shift_;
+        uint32_t max_buffered_;
+        protoson::pson_buffer payload_;
+        uint8_t* storage_;
+        size_t storage_size_;
+        bool storage_lent_;
+    };
+
 }
 
 #endif
\ No newline at end of file
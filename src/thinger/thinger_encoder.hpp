@@ -31,31 +31,89 @@ namespace thinger{
 
     class thinger_encoder : public protoson::pson_encoder{
 
+    public:
+        thinger_encoder(){
+        }
+
+        /**
+         * Compute the encoded size of a message. Submessage sizes are kept in its containers, so the next
+         * encoding of the message does not need to compute them again.
+         */
+        static size_t size(thinger_message& message){
+            thinger_encoder sink(true);
+            sink.encode(message);
+            return sink.bytes_written();
+        }
+
     protected:
+        explicit thinger_encoder(bool sizing) : protoson::pson_encoder(sizing){
+        }
+
         virtual bool write(const void *buffer, size_t size){
             return protoson::pson_encoder::write(buffer, size);
         }
 
     public:
         void encode(thinger_message& message){
+            encode_message(*this, message);
+        }
+
+        /**
+         * Encode the message fields
+         * @return false if the payload writer did not write exactly one complete value. The payload is then
+         * dropped and the message is flagged as an error, so it must be encoded again
+         */
+        template<class T>
+        static bool encode_message(T& encoder, thinger_message& message){
             if(message.get_stream_id()!=0){
-                pb_encode_varint(thinger_message::STREAM_ID, message.get_stream_id());
+                encoder.pb_encode_varint(thinger_message::STREAM_ID, message.get_stream_id());
             }
             if(message.get_signal_flag()!=thinger_message::NONE){
-                pb_encode_varint(thinger_message::SIGNAL_FLAG, message.get_signal_flag());
+                encoder.pb_encode_varint(thinger_message::SIGNAL_FLAG, message.get_signal_flag());
             }
             if(message.has_identifier()){
-                pb_encode_tag(protoson::pson_type, thinger_message::IDENTIFIER);
-                protoson::pson_encoder::encode(message.get_identifier());
+                encoder.pb_encode_tag(protoson::pson_type, thinger_message::IDENTIFIER);
+                encoder.protoson::pson_encoder::encode(message.get_identifier());
             }
             if(message.has_resource()){
-                pb_encode_tag(protoson::pson_type, thinger_message::RESOURCE);
-                protoson::pson_encoder::encode(message.get_resources());
+                encoder.pb_encode_tag(protoson::pson_type, thinger_message::RESOURCE);
+                encoder.protoson::pson_encoder::encode(message.get_resources());
             }
             if(message.has_data()){
-                pb_encode_tag(protoson::pson_type, thinger_message::PAYLOAD);
-                protoson::pson_encoder::encode((protoson::pson&) message);
+                encoder.pb_encode_tag(protoson::pson_type, thinger_message::PAYLOAD);
+                // payload writers go straight to seekable encoders, otherwise the payload is built as a pson
+                thinger_payload_writer* payload_writer = message.get_data_writer();
+                if(payload_writer!=NULL && encoder.is_seekable()){
+                    protoson::pson_writer writer(encoder);
+                    payload_writer->write_payload(writer);
+                    writer.close();
+                    if(!writer.complete()){
+                        // the writer is not run again to build the payload, as it may not write the same data
+                        message.clean_data();
+                        message.set_signal_flag(thinger_message::REQUEST_ERROR);
+                        return false;
+                    }
+                    return true;
+                }
+                encoder.protoson::pson_encoder::encode((protoson::pson&) message);
             }
+            return true;
+        }
+    };
+
+    /**
+     * Encodes complete message frames (message type, size, and message) in a memory buffer, in a single pass
+     * over the message, by back-patching the frame and submessage sizes.
+     */
+    class thinger_buffer_encoder : public protoson::pson_buffer_encoder{
+    public:
+        bool encode_frame(thinger_message& message){
+            pb_encode_varint(MESSAGE);
+            size_t position = pb_reserve_varint();
+            // a bad payload is not sent, the message is streamed again as an error without it
+            if(!thinger_encoder::encode_message(*this, message)) return false;
+            pb_patch_varint(position);
+            return good();
         }
     };
 
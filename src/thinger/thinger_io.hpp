@@ -34,6 +34,22 @@ namespace thinger {
     public:
         virtual bool read(char *buffer, size_t size) = 0;
         virtual bool write(const char *buffer, size_t size, bool flush = false) = 0;
+
+        /**
+         * Read up to size bytes that are already available, without waiting for more data. Returns the number
+         * of bytes read. Implementations that cannot tell the available bytes just perform a blocking read.
+         */
+        virtual size_t read_available(char *buffer, size_t size){
+            return read(buffer, size) ? size : 0;
+        }
+
+        /**
+         * Number of bytes that can be read without blocking. Implementations that cannot tell the available
+         * bytes return 0, so only one message is read per handle() call.
+         */
+        virtual size_t input_available(){
+            return 0;
+        }
     };
 
 }
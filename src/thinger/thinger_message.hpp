@@ -25,6 +25,7 @@
 #define THINGER_MESSAGE_HPP
 
 #include "pson.h"
+#include "thinger_stream_allocator.hpp"
 
 namespace thinger{
 
@@ -34,6 +35,20 @@ namespace thinger{
         KEEP_ALIVE          = 2
     };
 
+    /**
+     * Writes a message payload straight to the encoder, so it does not need to be built as a pson tree
+     */
+    class thinger_payload_writer{
+    public:
+        /**
+         * Write the payload as a single value. It may be called more than once for the same message: if the
+         * encoded frame does not fit in memory, it is called again to build the payload as a pson and stream it.
+         * A writer that does not write exactly one complete value makes the message be sent as an error, without
+         * the payload
+         */
+        virtual void write_payload(protoson::pson_writer& writer) = 0;
+    };
+
     class thinger_message{
 
     public:
@@ -79,10 +94,9 @@ namespace thinger{
         thinger_message(thinger_message& other) :
             stream_id(other.stream_id),
             flag(REQUEST_OK),
-            identifier(NULL),
-            resource(NULL),
+            fields(0),
             data(NULL),
-            data_allocated(false)
+            data_writer(NULL)
         {}
 
         /**
@@ -91,36 +105,78 @@ namespace thinger{
         thinger_message() :
             stream_id(0),
             flag(NONE),
-            identifier(NULL),
-            resource(NULL),
+            fields(0),
             data(NULL),
-            data_allocated(false)
+            data_writer(NULL)
         {}
 
-        ~thinger_message(){
-            // deallocate identifier
-            protoson::pool.destroy(identifier);
-            // deallocate resource
-            protoson::pool.destroy(resource);
-            // deallocate paylaod if was allocated here
-            if(data_allocated){
-                protoson::pool.destroy(data);
+        /**
+         * Move a message, taking its fields and payload. The source message is left empty
+         */
+        thinger_message(thinger_message&& other) :
+            stream_id(other.stream_id),
+            flag(other.flag),
+            fields(other.fields),
+            identifier(static_cast<protoson::pson&&>(other.identifier)),
+            resource(static_cast<protoson::pson&&>(other.resource)),
+            payload(static_cast<protoson::pson&&>(other.payload)),
+            data(other.data==&other.payload ? &payload : other.data),
+            data_view(other.data_view),
+            data_writer(other.data_writer)
+        {
+            other.fields = 0;
+            other.data = NULL;
+            other.data_view = protoson::pson_view();
+            other.data_writer = NULL;
+        }
+
+        thinger_message& operator=(thinger_message&& other){
+            if(this!=&other){
+                clean_identifier();
+                clean_resource();
+                clean_data();
+                stream_id = other.stream_id;
+                flag = other.flag;
+                fields = other.fields;
+                identifier = static_cast<protoson::pson&&>(other.identifier);
+                resource = static_cast<protoson::pson&&>(other.resource);
+                payload = static_cast<protoson::pson&&>(other.payload);
+                data = other.data==&other.payload ? &payload : other.data;
+                data_view = other.data_view;
+                data_writer = other.data_writer;
+                other.fields = 0;
+                other.data = NULL;
+                other.data_view = protoson::pson_view();
+                other.data_writer = NULL;
             }
+            return *this;
         }
 
     private:
+        // presence of the identifier and resource fields, as they are kept inside the message
+        enum field_flags{
+            identifier_field    = 1,
+            resource_field      = 2
+        };
+
         /// used for identifying a unique stream
         uint16_t stream_id;
         /// used for setting a stream signal
         signal_flag flag;
+        /// fields present in the message
+        uint8_t fields;
         /// used to identify a device, an endpoint, or a bucket
-        protoson::pson* identifier;
+        protoson::pson identifier;
         /// used to identify an specific resource over the identifier
-        protoson::pson* resource;
-        /// used to send a data payload in the message
+        protoson::pson resource;
+        /// payload reserved in the message
+        protoson::pson payload;
+        /// used to send a data payload in the message (the own payload, or an external pson)
         protoson::pson* data;
-        /// flag to determine when the payload has been reserved
-        bool data_allocated;
+        /// encoded payload in the received frame, decoded only if the payload is accessed as a pson
+        protoson::pson_view data_view;
+        /// writes the payload while encoding the message, if it is not provided as a pson
+        thinger_payload_writer* data_writer;
 
     public:
 
@@ -133,15 +189,15 @@ namespace thinger{
         }
 
         bool has_data(){
-            return data!=NULL;
+            return data!=NULL || data_view.valid() || data_writer!=NULL;
         }
 
         bool has_identifier(){
-            return identifier!=NULL;
+            return fields & identifier_field;
         }
 
         bool has_resource(){
-            return resource!=NULL;
+            return fields & resource_field;
         }
 
     public:
@@ -149,9 +205,14 @@ namespace thinger{
             thinger_message::stream_id = stream_id;
         }
 
+        /**
+         * Set the next stream id of the device request range. Ids are not kept while a response is pending
+         * @deprecated the requests sent by the thinger client already take their stream id from its allocator
+         */
         void set_random_stream_id(){
-            // TODO, random seed
-            thinger_message::stream_id = rand();
+            static thinger_stream_allocator<1> stream_ids;
+            thinger_message::stream_id = stream_ids.allocate();
+            stream_ids.release(thinger_message::stream_id);
         }
 
         void set_signal_flag(signal_flag const &flag) {
@@ -159,27 +220,24 @@ namespace thinger{
         }
 
         void set_identifier(const char* id){
-            if(identifier==NULL){
-                identifier = protoson::pool.allocate<protoson::pson>();
-            }
-            (*identifier) = id;
+            get_identifier() = id;
         }
 
         void clean_identifier(){
-            protoson::pool.destroy(identifier);
-            identifier = NULL;
+            identifier = protoson::pson();
+            fields &= ~identifier_field;
         }
 
         void clean_resource(){
-            protoson::pool.destroy(resource);
-            resource = NULL;
+            resource = protoson::pson();
+            fields &= ~resource_field;
         }
 
         void clean_data(){
-            if(data_allocated){
-                protoson::pool.destroy(data);
-            }
+            payload = protoson::pson();
             data = NULL;
+            data_view = protoson::pson_view();
+            data_writer = NULL;
         }
 
     public:
@@ -190,8 +248,15 @@ namespace thinger{
 
         operator protoson::pson&(){
             if(data==NULL){
-                data = protoson::pool.allocate<protoson::pson>();
-                data_allocated = true;
+                data = &payload;
+                // decode the received payload on first access
+                if(data_view.valid()) data_view.decode(*data);
+                // or build the payload from the writer
+                if(data_writer!=NULL){
+                    protoson::pson_writer writer(*data);
+                    data_writer->write_payload(writer);
+                }
+                data_writer = NULL;
             }
             return *data;
         }
@@ -201,17 +266,13 @@ namespace thinger{
         }
 
         protoson::pson& get_resources(){
-            if(resource==NULL){
-                resource = protoson::pool.allocate<protoson::pson>();
-            }
-            return *resource;
+            fields |= resource_field;
+            return resource;
         }
 
         protoson::pson& get_identifier(){
-            if(identifier==NULL){
-                identifier = protoson::pool.allocate<protoson::pson>();
-            }
-            return *identifier;
+            fields |= identifier_field;
+            return identifier;
         }
 
         protoson::pson& get_data(){
@@ -221,10 +282,45 @@ namespace thinger{
         void set_data(protoson::pson& pson_data){
             if(data==NULL){
                 data = &pson_data;
-                data_allocated = false;
             }
         }
 
+        /**
+         * Set the payload as a view over a received frame, so it is not decoded unless it is accessed as a
+         * pson. The frame buffer must outlive the message.
+         */
+        void set_data_view(const protoson::pson_view& view){
+            data_view = view;
+        }
+
+        /**
+         * Set a writer that provides the payload while the message is encoded. The writer must outlive the message.
+         */
+        void set_data_writer(thinger_payload_writer* writer){
+            data_writer = writer;
+        }
+
+        /**
+         * Writer providing the payload, if it has not been built as a pson yet
+         */
+        thinger_payload_writer* get_data_writer(){
+            return data==NULL ? data_writer : NULL;
+        }
+
+        /**
+         * Payload view over the received frame. It is empty if the message was not decoded from memory.
+         */
+        const protoson::pson_view& get_data_view(){
+            return data_view;
+        }
+
+        /**
+         * Take the given payload, so the message owns it and it does not need to outlive the message
+         */
+        void set_data(protoson::pson&& pson_data){
+            get_data() = static_cast<protoson::pson&&>(pson_data);
+        }
+
     };
 }
 
@@ -0,0 +1,144 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS SL
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef THINGER_OUTBOUND_QUEUE_HPP
+#define THINGER_OUTBOUND_QUEUE_HPP
+
+#include "pson.h"
+
+namespace thinger{
+
+    /**
+     * Priority classes of the outbound messages. Control and interactive messages are written as soon as they
+     * are sent, so they never wait behind bulk traffic, which is queued and written between them.
+     */
+    enum outbound_priority{
+        CONTROL_PRIORITY        = 0,    // connection management, i.e., authentication and keep alives
+        INTERACTIVE_PRIORITY    = 1,    // responses to the server, and requests waiting for a response
+        BULK_PRIORITY           = 2     // stream samples, stream events and bucket writes
+    };
+
+    /**
+     * Bounded FIFO of encoded frames waiting to be written. Frames are kept contiguous, so consecutive frames
+     * can be written in a single call, and only taken as a whole.
+     */
+    class thinger_outbound_queue{
+    public:
+        thinger_outbound_queue(size_t limit) : limit_(limit), head_(0){
+
+        }
+
+        /**
+         * Add a frame at the end of the queue
+         * @return false if the frame does not fit within the queue limit
+         */
+        bool push(const void* frame, size_t size){
+            if(this->size()+size>limit_) return false;
+            // reclaim the space of the frames already taken
+            if(head_>0){
+                size_t pending = this->size();
+                memmove(buffer_.data(), buffer_.data()+head_, pending);
+                buffer_.resize(pending);
+                head_ = 0;
+            }
+            return buffer_.append(frame, size);
+        }
+
+        /**
+         * Get the frames at the head of the queue, adding frames while they fit in the given size. The first
+         * frame is always included, whatever its size.
+         * @param max maximum number of bytes
+         * @param data set to the first queued frame
+         * @return number of bytes of the frames
+         */
+        size_t front(size_t max, const uint8_t*& data){
+            data = buffer_.data()+head_;
+            size_t available = size();
+            size_t size = 0;
+            while(size<available){
+                size_t frame = frame_size(data+size, available-size);
+                if(size>0 && size+frame>max) break;
+                size += frame;
+            }
+            return size;
+        }
+
+        /**
+         * Remove from the queue the frames returned by front()
+         */
+        void pop(size_t size){
+            head_ += size;
+            if(head_>=buffer_.size()){
+                buffer_.clear();
+                head_ = 0;
+            }
+        }
+
+        void clear(){
+            buffer_.release();
+            head_ = 0;
+        }
+
+        void set_limit(size_t limit){
+            limit_ = limit;
+        }
+
+        bool empty() const{
+            return size()==0;
+        }
+
+        /**
+         * @return number of queued bytes
+         */
+        size_t size() const{
+            return buffer_.size()-head_;
+        }
+
+    private:
+        /**
+         * Size of a queued frame: its message type and size varints, followed by the message
+         */
+        static size_t frame_size(const uint8_t* frame, size_t available){
+            size_t position = 0;
+            uint32_t value = 0;
+            for(uint8_t i=0; i<2; i++){
+                value = 0;
+                uint8_t shift = 0;
+                while(position<available){
+                    uint8_t byte = frame[position++];
+                    value |= (uint32_t)(byte & 0x7F) << shift;
+                    shift += 7;
+                    if(!(byte & 0x80)) break;
+                }
+            }
+            return position+value<=available ? position+value : available;
+        }
+
+        protoson::pson_buffer buffer_;
+        size_t limit_;
+        size_t head_;
+    };
+
+}
+
+#endif
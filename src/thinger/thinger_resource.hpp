@@ -44,7 +44,7 @@
 namespace thinger{
 
 
-class thinger_resource {
+class thinger_resource : public thinger_payload_writer {
 
 public:
     enum io_type {
@@ -53,7 +53,13 @@ public:
         pson_in             = 2,
         pson_out            = 3,
         pson_in_pson_out    = 4,
-        pson_stream         = 5
+        pson_stream         = 5,
+        pson_view_in        = 6,    // input read in place from the received frame (reported as pson_in)
+        pson_listener_in    = 7,    // input reported to a pson_listener as it is decoded (reported as pson_in)
+        pson_writer_out     = 8,    // output written with a pson_writer (reported as pson_out)
+        struct_in           = 9,    // input decoded in a struct with a pson_schema (reported as pson_in)
+        struct_out          = 10,   // output encoded from a struct with a pson_schema (reported as pson_out)
+        struct_in_out       = 11    // struct used for both input and output (reported as pson_in_pson_out)
     };
 
     enum access_type{
@@ -70,6 +76,23 @@ public:
 
 private:
 
+    // struct with a pson_schema bound as input or output
+    struct struct_binding{
+        void* value;
+        void (*read)(void* value, const protoson::pson_view& in);
+        void (*write)(void* value, protoson::pson_writer& out);
+    };
+
+    template<class T>
+    static void read_struct(void* value, const protoson::pson_view& in){
+        protoson::decode_struct(in, *(T*) value);
+    }
+
+    template<class T>
+    static void write_struct(void* value, protoson::pson_writer& out){
+        protoson::encode_struct(out, *(T*) value);
+    }
+
     // calback for function, input, output, or input/output
 #ifdef THINGER_USE_FUNCTIONAL
 
@@ -77,6 +100,10 @@ private:
         std::function<void()> run;
         std::function<void(protoson::pson& io)> pson;
         std::function<void(protoson::pson& in, protoson::pson& out)> pson_in_pson_out;
+        std::function<void(const protoson::pson_view& in)> view;
+        protoson::pson_listener* listener;
+        std::function<void(protoson::pson_writer& out)> writer;
+        struct_binding binding;
     };
 
 #else
@@ -85,6 +112,10 @@ private:
         void (*run)();
         void (*pson)(protoson::pson& io);
         void (*pson_in_pson_out)(protoson::pson& in, protoson::pson& out);
+        void (*view)(const protoson::pson_view& in);
+        protoson::pson_listener* listener;
+        void (*writer)(protoson::pson_writer& out);
+        struct_binding binding;
     };
 
 #endif
@@ -200,14 +231,30 @@ public:
 
     void fill_api(protoson::pson_object& content){
         if(io_type_!=none){
-            content["al"] = access_type_;
-            content["fn"] = io_type_;
+            content.borrow("al") = access_type_;
+            switch(io_type_){
+                case pson_view_in:
+                case pson_listener_in:
+                case struct_in:
+                    content.borrow("fn") = pson_in;
+                    break;
+                case pson_writer_out:
+                case struct_out:
+                    content.borrow("fn") = pson_out;
+                    break;
+                case struct_in_out:
+                    content.borrow("fn") = pson_in_pson_out;
+                    break;
+                default:
+                    content.borrow("fn") = io_type_;
+                    break;
+            }
         }
         thinger_map<thinger_resource>::entry* current = sub_resources_.begin();
         if(current!=NULL){
-            protoson::pson_object& actions = content["/"];
+            protoson::pson_object& actions = content.borrow("/");
             do{
-                current->value_.fill_api(actions[current->key_]);
+                current->value_.fill_api(actions.borrow(current->key_));
                 current = current->next_;
             }while(current!=NULL);
         }
@@ -220,15 +267,89 @@ public:
             callback_.pson(content["out"]);
         }else if(io_type_ == pson_in_pson_out){
             callback_.pson_in_pson_out(content["in"], content["out"]);
+        }else if(io_type_ == pson_writer_out){
+            protoson::pson_writer writer(content["out"]);
+            callback_.writer(writer);
+        }else if(io_type_ == struct_in || io_type_ == struct_in_out){
+            // the input is described with the current struct values
+            protoson::pson_writer writer(content["in"]);
+            callback_.binding.write(callback_.binding.value, writer);
+            if(io_type_ == struct_in_out){
+                protoson::pson_writer output(content["out"]);
+                callback_.binding.write(callback_.binding.value, output);
+            }
+        }else if(io_type_ == struct_out){
+            protoson::pson_writer writer(content["out"]);
+            callback_.binding.write(callback_.binding.value, writer);
         }
     }
 
     void fill_output(protoson::pson& content){
         if(io_type_ == pson_out){
             callback_.pson(content);
+        }else if(has_output_writer()){
+            protoson::pson_writer writer(content);
+            write_payload(writer);
+        }
+    }
+
+    // true if the resource takes an input, so changing it is notified to its stream
+    bool has_input(){
+        switch(io_type_){
+            case pson_in:
+            case pson_in_pson_out:
+            case pson_view_in:
+            case pson_listener_in:
+            case struct_in:
+            case struct_in_out:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // true if the output is written with a pson_writer instead of filling a pson
+    bool has_output_writer(){
+        return io_type_ == pson_writer_out || io_type_ == struct_out;
+    }
+
+    /**
+     * Fill the message payload with the resource output. Writer outputs are written while encoding the message
+     */
+    void fill_output(thinger_message& message){
+        if(has_output_writer()){
+            message.set_data_writer(this);
+        }else{
+            fill_output(message.get_data());
         }
     }
 
+    virtual void write_payload(protoson::pson_writer& writer){
+        if(io_type_ == pson_writer_out){
+            callback_.writer(writer);
+        }else if(io_type_ == struct_out || io_type_ == struct_in_out){
+            callback_.binding.write(callback_.binding.value, writer);
+        }
+    }
+
+    /**
+     * Writes the resource output as in the api description, i.e., {"out": ...}
+     */
+    class api_output_writer : public thinger_payload_writer{
+    public:
+        explicit api_output_writer(thinger_resource& resource) : resource_(resource){
+        }
+
+        virtual void write_payload(protoson::pson_writer& writer){
+            writer.begin_object().key("out");
+            resource_.write_payload(writer);
+            writer.end_object();
+        }
+
+    private:
+        thinger_resource& resource_;
+    };
+
     thinger_map<thinger_resource>& get_resources(){
         return sub_resources_;
     }
@@ -270,6 +391,24 @@ public:
         callback_.pson = in_function;
     }
 
+    /**
+     * Establish a function with input parameters that are read in place from the received frame, without
+     * decoding them. The view is valid only during the call.
+     */
+    void set_input_view(std::function<void(const protoson::pson_view&)> in_function){
+        io_type_ = pson_view_in;
+        callback_.view = in_function;
+    }
+
+    /**
+     * Establish a function that writes its output with a pson_writer, so it is encoded without building a
+     * pson tree. The function must write a single value.
+     */
+    void set_output_writer(std::function<void(protoson::pson_writer&)> out_function){
+        io_type_ = pson_writer_out;
+        callback_.writer = out_function;
+    }
+
     /**
      * Establish a function that only generates an output
      */
@@ -368,6 +507,24 @@ public:
         callback_.pson = in_function;
     }
 
+    /**
+     * Establish a function with input parameters that are read in place from the received frame, without
+     * decoding them. The view is valid only during the call.
+     */
+    void set_input_view(void (*in_function)(const protoson::pson_view& in)){
+        io_type_ = pson_view_in;
+        callback_.view = in_function;
+    }
+
+    /**
+     * Establish a function that writes its output with a pson_writer, so it is encoded without building a
+     * pson tree. The function must write a single value.
+     */
+    void set_output_writer(void (*out_function)(protoson::pson_writer& out)){
+        io_type_ = pson_writer_out;
+        callback_.writer = out_function;
+    }
+
     /**
      * Establish a function that only generates an output
      */
@@ -415,6 +572,64 @@ public:
 
 #endif
 
+    /**
+     * Establish a listener that receives the input as it is decoded, so large inputs are processed in constant
+     * memory. The listener must outlive the resource.
+     */
+    void set_input_listener(protoson::pson_listener& listener){
+        io_type_ = pson_listener_in;
+        callback_.listener = &listener;
+    }
+
+    protoson::pson_listener* get_input_listener(){
+        return io_type_==pson_listener_in ? callback_.listener : NULL;
+    }
+
+    /**
+     * Bind a struct with a pson_schema as the resource input, so the requests are decoded in place into the
+     * struct fields. The struct must outlive the resource.
+     */
+    template<class T>
+    void bind_input(T& value){
+        bind_struct(struct_in, value);
+    }
+
+    /**
+     * Bind a struct with a pson_schema as the resource output, so it is encoded without building a pson tree
+     */
+    template<class T>
+    void bind_output(T& value){
+        bind_struct(struct_out, value);
+    }
+
+    /**
+     * Bind a struct with a pson_schema as both the resource input and output
+     */
+    template<class T>
+    void bind(T& value){
+        bind_struct(struct_in_out, value);
+    }
+
+private:
+    template<class T>
+    void bind_struct(io_type type, T& value){
+        io_type_ = type;
+        callback_.binding.value = &value;
+        callback_.binding.read = &read_struct<T>;
+        callback_.binding.write = &write_struct<T>;
+    }
+
+    /**
+     * Request payload as a view. Payloads decoded from the socket are encoded again in the given encoder
+     */
+    static protoson::pson_view get_input_view(thinger_message& request, protoson::pson_buffer_encoder& encoder){
+        if(request.get_data_view().valid() || !request.has_data()) return request.get_data_view();
+        encoder.encode(request.get_data());
+        return protoson::pson_view(encoder.get_buffer().data(), encoder.get_buffer().size());
+    }
+
+public:
+
     /**
      * Handle a request and fill a possible response
      */
@@ -429,6 +644,9 @@ public:
                     case pson_out:
                         callback_.pson(response);
                         break;
+                    case pson_writer_out:
+                        response.set_data_writer(this);
+                        break;
                     case run:
                         callback_.run();
                         break;
@@ -438,6 +656,29 @@ public:
                     case pson_stream:
                         callback_.pson(request);
                         break;
+                    case pson_view_in: {
+                        protoson::pson_buffer_encoder encoder;
+                        callback_.view(get_input_view(request, encoder));
+                        break;
+                    }
+                    case struct_in:
+                    case struct_in_out: {
+                        protoson::pson_buffer_encoder encoder;
+                        callback_.binding.read(callback_.binding.value, get_input_view(request, encoder));
+                        if(io_type_ == struct_in_out) response.set_data_writer(this);
+                        break;
+                    }
+                    case struct_out:
+                        response.set_data_writer(this);
+                        break;
+                    case pson_listener_in:
+                        // buffered frames are replayed from memory, otherwise the payload was already streamed
+                        if(request.get_data_view().valid()){
+                            const protoson::pson_view& view = request.get_data_view();
+                            protoson::pson_memory_decoder decoder(view.data(), view.encoded_size());
+                            decoder.decode(*callback_.listener);
+                        }
+                        break;
                     case none:
                         break;
                 }
@@ -0,0 +1,116 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2017 THINK BIG LABS SL
+// Author: alvarolb@gmail.com (Alvaro Luis Bustamante)
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef THINGER_STREAM_ALLOCATOR_HPP
+#define THINGER_STREAM_ALLOCATOR_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+// range of stream ids used for the requests originated in the device, kept apart from the low ids the
+// server assigns to its own requests
+#ifndef THINGER_STREAM_ID_FIRST
+    #define THINGER_STREAM_ID_FIRST 0x8000
+#endif
+
+#ifndef THINGER_STREAM_ID_LAST
+    #define THINGER_STREAM_ID_LAST 0xFFFF
+#endif
+
+namespace thinger{
+
+    /**
+     * Hands out the stream ids of the device requests. Ids are taken in sequence from the device range, skipping
+     * the ones still waiting for a response, so an id is only reused after its request completed or timed out.
+     * @tparam capacity maximum number of requests in flight
+     */
+    template<size_t capacity>
+    class thinger_stream_allocator{
+    public:
+        thinger_stream_allocator() : next_(THINGER_STREAM_ID_FIRST), in_flight_(0), in_use_() {
+
+        }
+
+        /**
+         * Take a stream id for a new request
+         * @return the stream id, or 0 if there are already capacity requests in flight
+         */
+        uint16_t allocate(){
+            if(in_flight_>=capacity || in_flight_>(uint16_t)(THINGER_STREAM_ID_LAST-THINGER_STREAM_ID_FIRST)) return 0;
+            while(in_use(next_)) advance();
+            uint16_t stream_id = next_;
+            advance();
+            for(size_t i=0; i<capacity; i++){
+                if(in_use_[i]==0){
+                    in_use_[i] = stream_id;
+                    break;
+                }
+            }
+            ++in_flight_;
+            return stream_id;
+        }
+
+        /**
+         * Release a stream id once its request completed, failed, or timed out
+         * @return true if the stream id was in use
+         */
+        bool release(uint16_t stream_id){
+            if(stream_id==0) return false;
+            for(size_t i=0; i<capacity; i++){
+                if(in_use_[i]==stream_id){
+                    in_use_[i] = 0;
+                    --in_flight_;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool in_use(uint16_t stream_id) const{
+            if(stream_id==0) return false;
+            for(size_t i=0; i<capacity; i++){
+                if(in_use_[i]==stream_id) return true;
+            }
+            return false;
+        }
+
+        /**
+         * @return number of requests waiting for a response
+         */
+        uint16_t in_flight() const{
+            return in_flight_;
+        }
+
+    private:
+        void advance(){
+            next_ = next_>=THINGER_STREAM_ID_LAST ? THINGER_STREAM_ID_FIRST : next_+1;
+        }
+
+        uint16_t next_;
+        uint16_t in_flight_;
+        uint16_t in_use_[capacity];
+    };
+
+}
+
+#endif